@@ -14,6 +14,8 @@ extern "C" {
   void gracesignal (void *);
   void gracewait (void *);
   void * gracespawn (void *(*fn) (void *), void * arg);
+  void * gracespawn_unordered (void *(*fn) (void *), void * arg);
+  void * gracespawn_snapshot (void *(*fn) (void *), void * arg);
   void gracesync (void * v, void ** val);
   int graceid (void);
 
@@ -41,7 +41,7 @@ private:
   // First, we define the persistent heap (HEAP_SIZE bytes)
   // that actually stores the data.
   class persistentHeap :
-    public xpersist<char, xdefines::HEAP_SIZE> {};
+    public xpersist<char, xdefines::HEAP_SIZE, xdefines::HeapBlockSize> {};
 
   // Next, we adapt this heap, using the adapter class above,
   // which makes sure the persistent heap gets initialized
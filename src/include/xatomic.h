@@ -60,6 +60,35 @@ public:
   }
 
 
+  /// @brief Atomically set *obj to newval.
+  /// @return the original value of *obj.
+  inline static int exchange (volatile int * obj, int newval) {
+#if defined(__i386__) || defined(__x86_64__)
+    asm volatile ("lock; xchgl %0, %1"
+		  : "+r" (newval), "+m" (*obj)
+		  : : "memory");
+    return newval;
+#else
+    __sync_synchronize();
+    return __sync_lock_test_and_set (obj, newval);
+#endif
+  }
+
+  /// @brief Atomically set *obj to newval iff it equals oldval.
+  /// @return the original value of *obj.
+  inline static int compare_and_swap (volatile int * obj, int oldval, int newval) {
+#if defined(__i386__) || defined(__x86_64__)
+    int prev;
+    asm volatile ("lock; cmpxchgl %2, %1"
+		  : "=a" (prev), "+m" (*obj)
+		  : "r" (newval), "0" (oldval)
+		  : "memory");
+    return prev;
+#else
+    return __sync_val_compare_and_swap (obj, oldval, newval);
+#endif
+  }
+
   // Atomically increment 1 and return the original value.
   static inline int increment_and_return (volatile unsigned long * obj) {
     int i = 1;
@@ -93,6 +122,8 @@ public:
     // Memory barrier: x86 only for now.
 #if defined(__i386__)
     __asm__ __volatile__ ("lock; addl $0,0(%%esp)": : :"memory");
+#elif defined(__x86_64__)
+    __asm__ __volatile__ ("mfence": : :"memory");
 #endif
   }
 
@@ -79,6 +79,11 @@ private:
   /// The saved stack contents.
   unsigned long _stack[MAX_STACK_SIZE];
 
+  /// True while we are jumping back into getContext(). (Static,
+  /// because nothing below getContext's locals -- including its
+  /// copy of this -- gets restored.)
+  static volatile bool _restoring;
+
   NO_INLINE void save_stack (unsigned long *pbos, unsigned long *ptos);
 
   NO_INLINE void getContext (void);
@@ -26,6 +26,19 @@
 
 #define USE_XLATCH 1
 
+// How many bytes the heap and the globals each track as a unit (for
+// faults, read and write sets, and conflicts): a power-of-two number
+// of pages, up to 64K. Programs that sweep through big arrays want
+// bigger blocks; programs whose threads share small, scattered
+// objects want small ones.
+#ifndef GRACE_HEAP_BLOCK_SIZE
+#define GRACE_HEAP_BLOCK_SIZE 4096
+#endif
+
+#ifndef GRACE_GLOBALS_BLOCK_SIZE
+#define GRACE_GLOBALS_BLOCK_SIZE 4096
+#endif
+
 class xdefines {
 public:
   enum { STACK_SIZE = 16 * 1024 } ; // 1 * 1048576 };
@@ -33,6 +46,8 @@ public:
   enum { HEAP_SIZE = 1048576UL * 512 }; // FIX ME 512 };
   enum { PageSize = 4096UL };
   enum { PAGE_SIZE_MASK = (PageSize-1) };
+  enum { HeapBlockSize = GRACE_HEAP_BLOCK_SIZE };
+  enum { GlobalsBlockSize = GRACE_GLOBALS_BLOCK_SIZE };
   enum { NUM_HEAPS = 16 };
 };
 
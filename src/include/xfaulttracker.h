@@ -0,0 +1,80 @@
+// -*- C++ -*-
+
+/*
+  Author: Emery Berger, http://www.cs.umass.edu/~emery
+
+  Copyright (c) 2007-8 Emery Berger, University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef _XFAULTTRACKER_H_
+#define _XFAULTTRACKER_H_
+
+#include <stddef.h>
+
+/**
+ * @class xfaulttracker
+ * @brief The default way of finding out which pages get written:
+ * leave written pages protected, and catch the faults.
+ *
+ * Write trackers let xpersist grant write access to a page as soon
+ * as it is first touched, and find out later which of those pages
+ * were actually written. This one never can (track() always fails),
+ * so every write takes a protection fault.
+ *
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ */
+
+class xfaulttracker {
+public:
+
+  /// A run of written pages, [start, end).
+  struct run {
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long categories;
+  };
+
+  /// @brief Start tracking writes to a (freshly mapped) range.
+  /// @return true iff we can.
+  bool track (void *, size_t) {
+    return false;
+  }
+
+  /// @brief Get ready to track (again) in a new child process.
+  void forked (void) {}
+
+  /// @brief Start a transaction.
+  void arm (void) {}
+
+  /// @brief End a transaction.
+  void disarm (void) {}
+
+  /// @brief Arm tracking for pages we are about to make writable.
+  void protect (void *, size_t) {}
+
+  /// @brief Find the runs of written pages in [start, end).
+  /// @return the number of runs put in out (at most max).
+  /// @arg next  where to look next (end, once we are done).
+  int written (char *, char * end, run *, int, char ** next) {
+    *next = end;
+    return 0;
+  }
+
+};
+
+#endif
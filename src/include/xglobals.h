@@ -94,14 +94,33 @@ class xglobals {
 public:
   xglobals (void) {}
   void commit (void) {}
+  void beginDirect (bool) {}
+  bool isDirect (void) { return false; }
+  bool directElsewhere (void) { return false; }
+  bool isUnprotected (void) { return false; }
+  void rearm (void) {}
+  int stagedInts (void) { return 2; }
+  int stagedPages (void) { return 0; }
+  int stagedLength (const int *) { return 2; }
+  void stage (int * meta, char *) { meta[0] = meta[1] = 0; }
+  bool validateStaged (const int *) { return true; }
+  const char * applyStaged (const int *, const char * pages) { return pages; }
   void abort (void) {}
   void initialize (void) {}
   void begin (void) {}
+  void track (void) {}
   bool nop (void) { return true; }
   void lock (void) {}
   void unlock (void) {}
   bool consistent (void) { return true; }
+  bool validate (void) { return true; }
+  bool validateNow (void) { return true; }
   bool inRange (void *) { return false; }
+  bool pageSeen (void *) { return true; }
+  void handleFault (void *, bool) {}
+  void collectWrites (void) {}
+  void forked (void) {}
+  void setSnapshot (void) {}
   void recordRead (void *) {}
   void recordWrite (void *) {}
   void updateAll (void) {}
@@ -109,13 +128,13 @@ public:
 
 #else
 
-class xglobals : public xpersist<char,MAXSIZE>  {
+class xglobals : public xpersist<char,MAXSIZE,xdefines::GlobalsBlockSize>  {
 public:
 
   enum { MAX_GLOBALS_SIZE = MAXSIZE };
 
   xglobals (void)
-    : xpersist<char,MAX_GLOBALS_SIZE> ((void *) GLOBALS_START,
+    : xpersist<char,MAX_GLOBALS_SIZE,xdefines::GlobalsBlockSize> ((void *) GLOBALS_START,
 				       (size_t) GLOBALS_SIZE)
   {
     //    printf ("gracestart is %p\n", &gracestart);
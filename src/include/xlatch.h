@@ -52,9 +52,16 @@ public:
       return;
     } else {
       sem_wait (&_semaphore);
+      // Pass the wakeup along to the next waiter, if any.
+      sem_post (&_semaphore);
     }
   }
 
+  /// @return true iff the latch has been released.
+  inline bool isUnlatched (void) const {
+    return _unlatched;
+  }
+
   /// @brief Release the latch, waking up any waiters.
   inline void unlatch (void) {
     _unlatched = true;
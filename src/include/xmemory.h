@@ -4,6 +4,7 @@
 #define _XMEMORY_H_
 
 #include <signal.h>
+#include <stdio.h>
 
 #if !defined(_WIN32)
 #include <sys/wait.h>
@@ -14,16 +15,33 @@
 #include <unistd.h>
 #endif
 
-#include <set>
+#include <sched.h>
+#include <ucontext.h>
 
 #include "graceheap.h"
 #include "xglobals.h"
 #include "xrun.h"
 
-// Heap Layers
-#include "privateheap.h"
-#include "stlallocator.h"
+// Re-validate what a transaction has read whenever it touches a new
+// page (if anything has committed since), and roll it back right
+// away on a conflict rather than letting it run on to its end.
+#ifndef USE_EARLY_VALIDATION
+#define USE_EARLY_VALIDATION 1
+#endif
 
+// Tell writes from reads by the page fault error code (on x86), so
+// that the first write to a page takes one fault rather than two.
+#ifndef USE_WRITE_FAULT_BIT
+#define USE_WRITE_FAULT_BIT 1
+#endif
+
+#if USE_EARLY_VALIDATION && defined(linux)
+extern "C" {
+  // The bounds of the program's code (from the link script).
+  extern char __executable_start;
+  extern char etext;
+}
+#endif
 
 // Encapsulates all memory spaces (globals & heap).
 
@@ -31,7 +49,9 @@ class xmemory {
 private:
 
   // Private on purpose. See getInstance(), below.
-  xmemory (void) {
+  xmemory (void)
+    : _conflictHandler (NULL)
+  {
     // Initialize the memory spaces (globals and heap).
     _globals.initialize();
     _heap.initialize();
@@ -74,12 +94,14 @@ public:
   }
 
   void begin (void) {
-    // Reset pages seen (for signal handler).
-    _pages.clear();
-
-    // Reset global and heap protection.
+    // Reset global and heap protection (and the pages seen, for the
+    // signal handler).
     _globals.begin();
     _heap.begin();
+    // Only now that both have collected the writes made between
+    // transactions can we start tracking new ones.
+    _globals.track();
+    _heap.track();
   }
 
   /// @brief Record a read from this address.
@@ -114,40 +136,21 @@ public:
 #endif
   }
 
-  /// @brief Add a page to the list of pages seen so far this transaction.
-  inline void addPage (void * page) {
-    _pages.insert (page);
-  }
-
   /// @return true iff this page has already been touched in this xaction.
   inline bool pageSeen (void * page) {
-#if 0
-    {
-      char buf[255];
-      sprintf (buf, "read page %p\n", page);
-      printf (buf);
+    if (_heap.inRange (page)) {
+      return _heap.pageSeen (page);
     }
-#endif
-
-    pagesetType::iterator i = _pages.find (page);
-    bool found = (i != _pages.end());
-
-#if 0
-    {
-      char buf[255];
-      sprintf (buf, "found = %d\n", found);
-      printf (buf);
+    if (_globals.inRange (page)) {
+      return _globals.pageSeen (page);
     }
-#endif
-    
-    return found;
+    // Not ours: treat it as already seen, so the access just proceeds.
+    return true;
   }
 
+  /// @note Lock-free: each region validates against its commit clock.
   bool isConsistent (void) {
-    lock();
-    bool result = (_heap.consistent() && _globals.consistent());
-    unlock();
-    return result;
+    return (_heap.validate() && _globals.validate());
   }
 
   bool isNop (void) {
@@ -162,8 +165,13 @@ public:
 		
   bool tryToCommit (void) {
     bool committed = false;
-    lock();
+    lockToCommit();
     if (_heap.consistent() && _globals.consistent()) {
+      // Nothing can stop us committing now, so write out the output
+      // we buffered -- before the commit protects stdout's buffer
+      // again (write() cannot fault it back in), and while we hold
+      // the lock, so that it comes out in commit order.
+      fflush (stdout);
       _heap.commit();
       _globals.commit();
       committed = true;
@@ -172,11 +180,106 @@ public:
     return committed;
   }
 
+  /// @brief Publish everything written so far, and then write
+  /// straight to shared memory for the rest of the transaction.
+  /// @note Only safe for the process at the head of the commit
+  /// order, which nobody else can commit ahead of.
+  /// @arg unprotected  true iff no other process is running, so
+  /// nothing need track our writes at all (until rearm()).
+  /// @return false iff we were not consistent (nothing is published).
+  bool beginDirect (bool unprotected = false) {
+    lockToCommit();
+    if (!(_heap.consistent() && _globals.consistent())) {
+      unlock();
+      return false;
+    }
+    _heap.commit();
+    _globals.commit();
+    _heap.beginDirect (unprotected);
+    _globals.beginDirect (unprotected);
+    unlock();
+    return true;
+  }
+
+  bool isDirect (void) {
+    return _heap.isDirect();
+  }
+
+  bool isUnprotected (void) {
+    return _heap.isUnprotected();
+  }
+
+  /// @brief Leave unprotected mode at the next commit.
+  void rearm (void) {
+    _heap.rearm();
+    _globals.rearm();
+  }
+
+  /// @brief From now on, let the app read anything without faulting,
+  /// and check just the pages it writes for conflicts (as in snapshot
+  /// isolation). Reads see whatever was last committed.
+  /// @note Only call this between transactions.
+  void setSnapshot (void) {
+    _heap.setSnapshot();
+    _globals.setSnapshot();
+  }
+
+  /// @brief Get ready to run in a newly-forked child.
+  void forked (void) {
+    _heap.forked();
+    _globals.forked();
+  }
+
+  /// @return the number of bytes stage() needs.
+  size_t stagedSize (void) {
+    _heap.collectWrites();
+    _globals.collectWrites();
+    return stagedHeader() + (_heap.stagedPages() + _globals.stagedPages()) * xdefines::PageSize;
+  }
+
+  /// @brief Save this transaction's write set (and what it read) so
+  /// that any process can commit it later with applyStaged().
+  /// @note The buffer holds the offset of the page contents, the
+  /// heap's and globals' descriptions, and then the page contents.
+  void stage (void * buf) {
+    int * meta = (int *) buf;
+    char * pages = (char *) buf + stagedHeader();
+    meta[0] = stagedHeader();
+    meta++;
+    _heap.stage (meta, pages);
+    meta += _heap.stagedInts();
+    pages += _heap.stagedPages() * xdefines::PageSize;
+    _globals.stage (meta, pages);
+  }
+
+  /// @brief Commit a staged transaction, if it is still consistent.
+  /// @return true iff it committed.
+  bool applyStaged (const void * buf) {
+    const int * heapMeta = (const int *) buf + 1;
+    const int * globalsMeta = heapMeta + _heap.stagedLength (heapMeta);
+    bool committed = false;
+    lockToCommit();
+    if (_heap.validateStaged (heapMeta) && _globals.validateStaged (globalsMeta)) {
+      const char * pages = (const char *) buf + *((const int *) buf);
+      pages = _heap.applyStaged (heapMeta, pages);
+      _globals.applyStaged (globalsMeta, pages);
+      committed = true;
+    }
+    unlock();
+    return committed;
+  }
+
   void abort (void) {
     _heap.abort();
     _globals.abort();
   }
 
+  /// @brief Call this to roll back a transaction found to conflict
+  /// while it runs.
+  void setConflictHandler (void (*fn) (void)) {
+    _conflictHandler = fn;
+  }
+
 private:
 
   void lock (void) {
@@ -189,6 +292,25 @@ private:
     _globals.unlock();
   }
 
+  /// @brief Lock, once no other process is writing straight to
+  /// shared memory: we cannot check against what it read, so we
+  /// wait for the end of its transaction.
+  void lockToCommit (void) {
+    lock();
+    while (_heap.directElsewhere() || _globals.directElsewhere()) {
+      unlock();
+      sched_yield();
+      lock();
+    }
+  }
+
+  /// @return the size of the descriptions at the start of a staged
+  /// transaction (rounded up to a page).
+  int stagedHeader (void) {
+    int ints = 1 + _heap.stagedInts() + _globals.stagedInts();
+    return (ints * sizeof(int) + xdefines::PageSize - 1) & ~(xdefines::PageSize - 1);
+  }
+
 public:
 
   /* Signal-related functions for tracking page accesses. */
@@ -202,31 +324,19 @@ public:
 
     // Check if this was a SEGV that we are supposed to trap.
     if (siginfo->si_code == SEGV_ACCERR) {
-      // Compute the page that holds this address.
-      void * page = (void *) (((size_t) addr) & ~(xdefines::PageSize-1));
-
-      // Determine whether this access was a read or a write.
-      if (!xmemory::getInstance().pageSeen (page)) {
-#if 0 // ndef NDEBUG
-	printf ("new page: %x\n", page); fflush (stdout);
-#endif
-	// We haven't seen this page yet, so we consider this a read.
-	// Change the page to read-only, and record the read.
-	xmemory::getInstance().addPage (page);
-	mprotect ((char *) page, 
-		  xdefines::PageSize,
-		  PROT_READ);
-	xmemory::getInstance().recordRead (addr);
+      // Let the region holding this address decide whether it was
+      // a read or a write (and give the app access to the page).
+      xmemory& mem = xmemory::getInstance();
+      if (mem._heap.inRange (addr)) {
+	mem.handleFault (mem._heap, addr, context);
+      } else if (mem._globals.inRange (addr)) {
+	mem.handleFault (mem._globals, addr, context);
       } else {
-#if 0 // ndef NDEBUG
-	printf ("write to page: %x\n", page); fflush (stdout);
-#endif
-	// Already saw it: now it was a write.  Give the app full
-	// access to the page, and record the write.
-	mprotect ((char *) page,
-		  xdefines::PageSize,
-		  PROT_READ | PROT_WRITE | PROT_EXEC);
-	xmemory::getInstance().recordWrite (addr);
+	// Not one of ours: a real access violation (e.g., a write to
+	// a string literal). Retrying would just fault again forever,
+	// so die of it instead.
+	signal (SIGSEGV, SIG_DFL);
+	raise (SIGSEGV);
       }
     } else if (siginfo->si_code == SEGV_MAPERR) {
 
@@ -249,6 +359,55 @@ public:
     }
   }
 
+  /// @brief Handle a protection fault on a page in this region.
+  template <class Region>
+  inline void handleFault (Region& r, void * addr, void * context) {
+#if USE_EARLY_VALIDATION
+    if (!r.pageSeen (addr)) {
+      // Don't bother reading any further if we are already doomed.
+      checkEarly (context);
+    }
+#endif
+    r.handleFault (addr, isWrite (context));
+  }
+
+  /// @return true iff we can tell that the fault was a write.
+  static bool isWrite (void * context) {
+#if USE_WRITE_FAULT_BIT && defined(linux) && (defined(__x86_64__) || defined(__i386__))
+    // Bit 1 of the page fault error code is set for writes.
+    return (((ucontext_t *) context)->uc_mcontext.gregs[REG_ERR] & 2);
+#else
+    return false;
+#endif
+  }
+
+#if USE_EARLY_VALIDATION
+  /// @brief Roll back now if something we read has been overwritten.
+  /// @note Only when the program itself faulted: a library (e.g.,
+  /// stdio) could be holding locks that a rollback would never release.
+  void checkEarly (void * context) {
+    if (_conflictHandler
+	&& inProgram (context)
+	&& !(_heap.validateNow() && _globals.validateNow())) {
+      _conflictHandler();
+    }
+  }
+
+  /// @return true iff the faulting instruction is in the program's code.
+  static bool inProgram (void * context) {
+#if defined(linux) && defined(__x86_64__)
+    size_t pc = ((ucontext_t *) context)->uc_mcontext.gregs[REG_RIP];
+#elif defined(linux) && defined(__i386__)
+    size_t pc = ((ucontext_t *) context)->uc_mcontext.gregs[REG_EIP];
+#else
+    return false;
+#endif
+#if defined(linux)
+    return ((pc >= (size_t) &__executable_start) && (pc < (size_t) &etext));
+#endif
+  }
+#endif
+
   /// @brief Install a handler for SEGV signals.
   void installSignalHandler (void) {
     sigset_t block_set;
@@ -294,15 +453,11 @@ private:
   /// The heap used to satisfy all client memory requests.
   graceheap		_heap;
 
-  typedef std::set<void *, less<void *>,
-		   HL::STLAllocator<void *, privateheap> > // myHeap> >
-  pagesetType;
-
-  /// The set of pages that have been accessed in a given transaction.
-  pagesetType      _pages;
-
   /// A signal stack, for catching signals.
   stack_t          _sigstk;
+
+  /// Rolls back the current transaction.
+  void (*_conflictHandler) (void);
 };
 
 #endif
@@ -37,9 +37,23 @@ public:
 
   void initialize (void) { getHeap()->initialize(); }
   void begin (void) { getHeap()->begin(); }
+  void track (void) { getHeap()->track(); }
   void abort (void) { getHeap()->abort(); }
   bool consistent (void) { return getHeap()->consistent(); }
+  bool validate (void) { return getHeap()->validate(); }
+  bool validateNow (void) { return getHeap()->validateNow(); }
   void commit (void) { getHeap()->commit(); }
+  void beginDirect (bool unprotected) { getHeap()->beginDirect (unprotected); }
+  bool isDirect (void) { return getHeap()->isDirect(); }
+  bool directElsewhere (void) { return getHeap()->directElsewhere(); }
+  bool isUnprotected (void) { return getHeap()->isUnprotected(); }
+  void rearm (void) { getHeap()->rearm(); }
+  int stagedInts (void) { return getHeap()->stagedInts(); }
+  int stagedPages (void) { return getHeap()->stagedPages(); }
+  int stagedLength (const int * meta) { return getHeap()->stagedLength (meta); }
+  void stage (int * meta, char * pages) { getHeap()->stage (meta, pages); }
+  bool validateStaged (const int * meta) { return getHeap()->validateStaged (meta); }
+  const char * applyStaged (const int * meta, const char * pages) { return getHeap()->applyStaged (meta, pages); }
   void updateAll (void) { getHeap()->updateAll(); }
   void commitMemory (void) { getHeap()->commitMemory(); }
 
@@ -50,6 +64,11 @@ public:
 
   bool nop (void) { return getHeap()->nop(); }
   bool inRange (void * ptr) { return getHeap()->inRange(ptr); }
+  bool pageSeen (void * ptr) { return getHeap()->pageSeen(ptr); }
+  void handleFault (void * ptr, bool isWrite) { getHeap()->handleFault(ptr, isWrite); }
+  void collectWrites (void) { getHeap()->collectWrites(); }
+  void forked (void) { getHeap()->forked(); }
+  void setSnapshot (void) { getHeap()->setSnapshot(); }
   void recordWrite (void * ptr) { getHeap()->recordWrite(ptr); }
   void recordRead (void * ptr) { getHeap()->recordRead(ptr); }
 
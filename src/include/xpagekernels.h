@@ -0,0 +1,142 @@
+// -*- C++ -*-
+
+/*
+  Author: Emery Berger, http://www.cs.umass.edu/~emery
+
+  Copyright (c) 2007-8 Emery Berger, University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef _XPAGEKERNELS_H_
+#define _XPAGEKERNELS_H_
+
+/**
+ * @class xpagekernels
+ * @brief Whole-page compare, merge and copy kernels.
+ *
+ * Each kernel operates on one page-aligned page (xdefines::PageSize
+ * bytes). There are generic, SSE2, AVX2 and AVX-512 versions of
+ * every kernel; the best one the processor supports is chosen (via
+ * cpuid) the first time any kernel is called.
+ *
+ * A twin is a pristine copy of a page taken just before it was first
+ * written, so the differences between a page and its twin are
+ * exactly the bytes written in the current transaction.
+ *
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ */
+
+class xpagekernels {
+public:
+
+  /// The instruction set levels for which there are kernels.
+  enum level { GENERIC, SSE2, AVX2, AVX512, NUM_LEVELS };
+
+  /// @brief Write the bytes of local that differ from twin into dest.
+  /// @note dest must not be concurrently written by anyone else.
+  static inline void writeDiffs (const void * local,
+				 const void * twin,
+				 void * dest)
+  {
+    _writeDiffs (local, twin, dest);
+  }
+
+  /// @return true iff some byte was changed both locally and in the
+  /// committed copy (i.e., a write-write conflict on the same byte).
+  static inline bool conflicts (const void * local,
+				const void * twin,
+				const void * committed)
+  {
+    return _conflicts (local, twin, committed);
+  }
+
+  /// @return true iff the two pages have identical contents.
+  static inline bool equal (const void * a,
+			    const void * b)
+  {
+    return _equal (a, b);
+  }
+
+  /// @return true iff every byte of the page is zero.
+  static inline bool isZero (const void * page)
+  {
+    return _isZero (page);
+  }
+
+  /// @brief Copy each byte of src whose mask byte is non-zero into dest.
+  /// @note dest must not be concurrently written by anyone else.
+  static inline void maskedCopy (const void * src,
+				 const void * mask,
+				 void * dest)
+  {
+    _maskedCopy (src, mask, dest);
+  }
+
+  /// @return a bitmask whose bit i is set iff a[i] != b[i], for
+  /// 0 <= i < 32 (used to compare runs of version numbers).
+  static inline unsigned int differingInts (const int * a,
+					    const int * b)
+  {
+    return _differingInts (a, b);
+  }
+
+  /// @return the best level supported by this processor.
+  static level best (void);
+
+  /// @return true iff this processor can run the given level.
+  static bool supported (level l);
+
+  /// @brief Use the kernels for the given (supported) level.
+  static void select (level l);
+
+  /// @return the currently selected level.
+  static level selected (void);
+
+  /// @return a printable name for the given level.
+  static const char * name (level l);
+
+private:
+
+  typedef void (*writeDiffsFunction) (const void *, const void *, void *);
+  typedef bool (*conflictsFunction) (const void *, const void *, const void *);
+  typedef bool (*equalFunction) (const void *, const void *);
+  typedef bool (*isZeroFunction) (const void *);
+  typedef void (*maskedCopyFunction) (const void *, const void *, void *);
+  typedef unsigned int (*differingIntsFunction) (const int *, const int *);
+
+  // Each kernel pointer starts out at a stub that selects the best
+  // level and then forwards the call.
+
+  static writeDiffsFunction _writeDiffs;
+  static conflictsFunction  _conflicts;
+  static equalFunction      _equal;
+  static isZeroFunction     _isZero;
+  static maskedCopyFunction _maskedCopy;
+  static differingIntsFunction _differingInts;
+
+  static level _selected;
+
+  static void firstWriteDiffs (const void *, const void *, void *);
+  static bool firstConflicts (const void *, const void *, const void *);
+  static bool firstEqual (const void *, const void *);
+  static bool firstIsZero (const void *);
+  static void firstMaskedCopy (const void *, const void *, void *);
+  static unsigned int firstDifferingInts (const int *, const int *);
+
+};
+
+#endif
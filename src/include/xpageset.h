@@ -0,0 +1,122 @@
+// -*- C++ -*-
+
+/*
+  Author: Emery Berger, http://www.cs.umass.edu/~emery
+
+  Copyright (c) 2007-8 Emery Berger, University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef _XPAGESET_H_
+#define _XPAGESET_H_
+
+#include <assert.h>
+
+#include "bitstring.h"
+
+/**
+ * @class xpageset
+ * @brief A set of page numbers in [0, NPages).
+ *
+ * A bitmap answers membership queries, and a list of the pages
+ * inserted so far (in insertion order) supports iteration and
+ * clearing in time proportional to the number of pages in the set.
+ * Nothing is ever allocated, so it is safe to use from the signal
+ * handler.
+ *
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ */
+
+template <int NPages>
+class xpageset {
+public:
+
+  typedef const int * iterator;
+
+  xpageset (void)
+    : _size (0)
+  {
+    // BitString starts out with every bit set.
+    _bits.free (0, NPages);
+  }
+
+  /// @brief Add a page to the set.
+  /// @return true iff the page was not already in the set.
+  inline bool insert (int pageNo) {
+    assert (pageNo >= 0);
+    assert (pageNo < NPages);
+    if (_bits.get (pageNo)) {
+      return false;
+    }
+    _bits.set (pageNo);
+    _pages[_size++] = pageNo;
+    return true;
+  }
+
+  /// @return true iff the page is in the set.
+  inline bool contains (int pageNo) const {
+    return _bits.get (pageNo);
+  }
+
+  /// @brief Empty the set.
+  inline void clear (void) {
+    for (int i = 0; i < _size; i++) {
+      _bits.reset (_pages[i]);
+    }
+    _size = 0;
+  }
+
+  /// The number of pages covered by each word() (BitString uses
+  /// 32 bits of each word).
+  enum { PagesPerWord = 32 };
+
+  /// @return a bitmask of which of pages [i * PagesPerWord, (i+1) *
+  /// PagesPerWord) are in the set.
+  inline unsigned int word (int i) {
+    return (unsigned int) _bits (i);
+  }
+
+  inline bool empty (void) const {
+    return (_size == 0);
+  }
+
+  inline int size (void) const {
+    return _size;
+  }
+
+  inline iterator begin (void) const {
+    return &_pages[0];
+  }
+
+  inline iterator end (void) const {
+    return &_pages[_size];
+  }
+
+private:
+
+  /// One bit per page: set iff the page is in the set.
+  BitString<NPages> _bits;
+
+  /// The number of pages in the set.
+  int _size;
+
+  /// The pages in the set, in insertion order.
+  int _pages[NPages];
+
+};
+
+#endif
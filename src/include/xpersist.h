@@ -3,15 +3,23 @@
 #ifndef _XPERSIST_H_
 #define _XPERSIST_H_
 
-#include <set>
-
 #if !defined(_WIN32)
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #endif
 
+#if defined(linux)
+#include <sys/syscall.h>
+// (Older C libraries do not define this in <sys/mman.h>; see <linux/memfd.h>.)
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
+
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,13 +29,99 @@
 #include "freelistheap.h"
 #include "zoneheap.h"
 
-#include "stlallocator.h"
-#include "privateheap.h"
 #include "xplock.h"
 #include "xdefines.h"
+#include "xpagekernels.h"
+#include "xpageset.h"
+
+#include "xfaulttracker.h"
 
 #define USE_MSYNC 0
 
+// Have every region (i.e., the heap and globals) share one commit
+// lock, since commits always take them all anyway.
+#ifndef USE_SHARED_COMMIT_LOCK
+#define USE_SHARED_COMMIT_LOCK 1
+#endif
+
+// Commit only the bytes each transaction changed (by comparing dirty
+// pages against twins), and let transactions that write disjoint
+// bytes of the same page both commit. NOTE: this relaxes conflict
+// detection for written pages to write-write conflicts on the same
+// bytes, so it is only safe for programs whose threads do not read
+// what other threads write on those pages.
+#ifndef USE_DIFF_COMMIT
+#define USE_DIFF_COMMIT 0
+#endif
+
+// When a page we read has a newer committed version, compare its
+// contents before declaring a conflict. This requires freezing a
+// private copy of each page as it is first read (a page copy per
+// read fault), so that what we compare is exactly what we saw.
+#ifndef USE_VALUE_VALIDATION
+#define USE_VALUE_VALIDATION 0
+#endif
+
+// Ask for transparent huge pages for the shared (committed) copy of
+// each region. (The private view keeps using small pages, since we
+// track accesses a page at a time.) Only takes effect if the kernel
+// allows huge pages for shared memory -- see
+// /sys/kernel/mm/transparent_hugepage/shmem_enabled.
+#ifndef USE_HUGE_PERSISTENT
+#define USE_HUGE_PERSISTENT 0
+#endif
+
+// Let pages be written as soon as they are first touched, and find
+// out which ones were written with userfaultfd write protection
+// (USE_UFFD_TRACKING) or soft-dirty bits (USE_SOFTDIRTY_TRACKING) --
+// if the kernel lets us -- rather than with a fault on every first
+// write. Not compatible with twins or frozen pages, which are written
+// behind the app's back.
+#ifndef USE_UFFD_TRACKING
+#define USE_UFFD_TRACKING 0
+#endif
+
+#ifndef USE_SOFTDIRTY_TRACKING
+#define USE_SOFTDIRTY_TRACKING 0
+#endif
+
+#if USE_UFFD_TRACKING && defined(linux) && !USE_DIFF_COMMIT && !USE_VALUE_VALIDATION
+#include "xuffdtracker.h"
+typedef xuffdtracker writeTrackerType;
+#elif USE_SOFTDIRTY_TRACKING && defined(linux) && !USE_DIFF_COMMIT && !USE_VALUE_VALIDATION
+#include "xsoftdirtytracker.h"
+typedef xsoftdirtytracker writeTrackerType;
+#else
+typedef xfaulttracker writeTrackerType;
+#endif
+
+// When a transaction faults on pages in order, make the pages after
+// them readable (and part of the read set) at the same time, over a
+// growing window. Fewer faults for sequential scans, but more pages
+// to validate (and maybe conflict on).
+#ifndef USE_FAULT_AROUND
+#define USE_FAULT_AROUND 1
+#endif
+
+// Leave pages that a transaction only read readable afterwards, and
+// start the next transaction's read set with them (as long as nobody
+// has committed them since), rather than protecting them and taking
+// a fault on them all over again. Frozen pages are private copies, so
+// they cannot stay.
+#ifndef USE_STICKY_READS
+#if USE_VALUE_VALIDATION
+#define USE_STICKY_READS 0
+#else
+#define USE_STICKY_READS 1
+#endif
+#endif
+
+// Break copy-on-write for a page as soon as we see it written, from
+// the fault handler (needs Linux 5.14 or later).
+#ifndef USE_POPULATE_WRITE
+#define USE_POPULATE_WRITE 0
+#endif
+
 #if defined(sun)
 extern "C" int madvise(caddr_t addr, size_t len, int advice);
 #endif
@@ -36,11 +130,19 @@ extern "C" int madvise(caddr_t addr, size_t len, int advice);
  * @class xpersist
  * @brief Makes a range of memory persistent and consistent.
  *
+ * Accesses are tracked (and conflicts detected) in blocks of
+ * BlockSize bytes, which are what "pages" means in the rest of this
+ * class: each has its own version and protection. Bigger blocks mean
+ * fewer faults and smaller read and write sets for code that sweeps
+ * through large arrays, but more false conflicts for code whose
+ * threads touch data that lies close together.
+ *
  * @author Emery Berger <http://www.cs.umass.edu/~emery>
  */
 
 template <class Type,
-	  int NElts = 1>
+	  int NElts = 1,
+	  int BlockSize = xdefines::PageSize>
 class xpersist {
 public:
 
@@ -50,29 +152,32 @@ public:
     : _isLocked (false),
       _startaddr (startaddr),
       _startsize (startsize),
-      _initialized (false)
+      _initialized (false),
+      _direct (false),
+      _unprotected (false),
+      _tracking (false),
+      _nextRead (-1),
+      _readAhead (1),
+      _snapshot (false),
+      _snapshotVersions (NULL),
+      _stale (false),
+      _remapAll (true)
   {
 
-    char _backingFname[L_tmpnam];
-    char _versionsFname[L_tmpnam];
-
-    // Get a temporary file name (which had better not be NFS-mounted...).
-    sprintf (_backingFname, "graceMXXXXXX");
-    _backingFd = mkstemp (_backingFname);
+    _backingFd = makeFile ("graceM");
+    _versionsFd = makeFile ("graceV");
 
     if ((_backingFd == -1) || (_versionsFd == -1)) {
       fprintf (stderr, "Failed to make persistent file.\n");
       ::abort();
     }
 
-    // Get another temporary file name (which had better not be NFS-mounted...).
-    sprintf (_versionsFname, "graceVXXXXXX");
-    _versionsFd = mkstemp (_versionsFname);
+    memset (_pageState, UNTOUCHED, sizeof(_pageState));
 
     // Set the files to the sizes of the desired object.
     int result;
     result = ftruncate (_backingFd,  NElts * sizeof(Type));
-    result |= ftruncate (_versionsFd, VersionArrayLength * sizeof(int));
+    result |= ftruncate (_versionsFd, VersionFileSize);
     if (result) {
       // Some sort of mysterious error.
       // Adios.
@@ -80,10 +185,6 @@ public:
       ::abort();
     }
 
-    // Get rid of the files when we exit.
-    unlink (_backingFname);
-    unlink (_versionsFname);
-
     //
     // Establish two maps to the backing file.
     //
@@ -96,6 +197,10 @@ public:
 				       _backingFd,
 				       0);
 
+#if USE_HUGE_PERSISTENT && defined(MADV_HUGEPAGE)
+    madvise (_persistentMemory, NElts * sizeof(Type), MADV_HUGEPAGE);
+#endif
+
     // If we specified a start address, copy the contents into the
     // persistent area now because the transient memory map is going
     // to squash it.
@@ -117,15 +222,29 @@ public:
     //    printf ("transient = %p, persistent = %p, size = %ld\n", _transientMemory, _persistentMemory, NElts * sizeof(Type));
 #endif
 
-    // Finally, map the version numbers.
+    // Finally, map the version numbers. The superblock summaries
+    // follow them, and the commit clock (and the direct-writer flag)
+    // live on their own page after that.
     _persistentVersions = (int *)
       mmap (NULL,
-	    VersionArrayLength * sizeof(int),
+	    VersionFileSize,
 	    PROT_READ | PROT_WRITE,
 	    MAP_SHARED,
 	    _versionsFd,
 	    0);
 
+    _persistentSummaries = (int *)
+      ((char *) _persistentVersions + VersionArrayBytes);
+
+    _commitClock = (volatile unsigned int *)
+      ((char *) _persistentSummaries + SummaryArrayBytes);
+    _validatedClock = *_commitClock;
+    _directWriter = _commitClock + 1;
+
+    // Create the lock now, before anyone forks, so that everyone
+    // shares it.
+    getLock();
+
     _localVersions = (int *)
       mmap (NULL,
 	    VersionArrayLength * sizeof(int),
@@ -135,6 +254,22 @@ public:
 	    0);
 
 
+#if USE_DIFF_COMMIT
+    // Reserve room for one twin per page. Twins are only
+    // materialized for pages that actually get written.
+    _twinMemory = (Type *)
+      mmap (NULL,
+	    NElts * sizeof(Type),
+	    PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+	    -1,
+	    0);
+
+    if (_twinMemory == MAP_FAILED) {
+      ::abort();
+    }
+#endif
+
     if ((_transientMemory == MAP_FAILED) ||
 	(_persistentMemory == MAP_FAILED) ||
 	(_localVersions == MAP_FAILED) ||
@@ -149,7 +284,13 @@ public:
     // Unmap everything.
     munmap (_transientMemory,  NElts * sizeof(Type));
     munmap (_persistentMemory, NElts * sizeof(Type));
-    munmap (_persistentVersions, VersionArrayLength * sizeof(int));
+    munmap (_persistentVersions, VersionFileSize);
+#if USE_DIFF_COMMIT
+    munmap (_twinMemory, NElts * sizeof(Type));
+#endif
+    if (_snapshotVersions) {
+      munmap (_snapshotVersions, VersionArrayLength * sizeof(int));
+    }
     close (_backingFd);
     close (_versionsFd);
   }
@@ -193,6 +334,154 @@ public:
   }
 
 
+  /// @return true iff the page holding this address was already
+  /// touched in this transaction.
+  inline bool pageSeen (void * addr) {
+    if (_direct) {
+      // Pages are always readable, so any fault is a write.
+      return true;
+    }
+    int index = (size_t) addr - (size_t) base();
+    return (_pageState[computePage (index)] != UNTOUCHED);
+  }
+
+
+  /// @brief Handle a protection fault at this (in-range) address.
+  /// @arg isWrite  true if we know the fault was a write.
+  /// @note Otherwise, the page's state tells us all we need: the
+  /// first fault on a page is a read, and the next is a write.
+  inline void handleFault (void * addr, bool isWrite) {
+    int pageNo = computePage ((size_t) addr - (size_t) base());
+    char * page = (char *) base() + pageNo * BlockSize;
+    if (_direct || (_pageState[pageNo] != UNTOUCHED)) {
+      makeWritable (page);
+      recordWrite (addr);
+    } else if (isWrite || _snapshot) {
+      // A first touch that writes: it reads the current version too,
+      // so record both at once rather than taking another fault.
+      recordRead (addr);
+      if (_snapshot && (_localVersions[pageNo] != _snapshotVersions[pageNo])) {
+	// Someone committed this page since we began, and the app may
+	// have read it before then (without faulting): whatever it is
+	// about to write may be based on what they overwrote.
+	_stale = true;
+      }
+      makeWritable (page);
+      recordWrite (addr);
+    } else {
+      // A read (of this page, and maybe the next few).
+      int count = readAhead (pageNo);
+      size_t len = count * BlockSize;
+      if (_tracking) {
+	// Let the app write them, too: the tracker will tell us if it did.
+	_tracker.protect (page, len);
+	mprotect (page, len, PROT_READ | PROT_WRITE | PROT_EXEC);
+      } else {
+	mprotect (page, len, PROT_READ);
+      }
+      for (int i = 0; i < count; i++) {
+	recordRead (page + i * BlockSize);
+      }
+    }
+  }
+
+  /// @return how many (untouched) pages to make readable, starting
+  /// with this one, which the app just read.
+  /// @note When reads fault in order, we read ahead, over a window
+  /// that doubles each time the app reads up to its end.
+  inline int readAhead (int pageNo) {
+#if USE_FAULT_AROUND
+    if (pageNo == _nextRead) {
+      if (_readAhead < MaxReadAhead) {
+	_readAhead *= 2;
+      }
+    } else {
+      _readAhead = 1;
+    }
+    int count = 1;
+    while ((count < _readAhead)
+	   && (pageNo + count < VersionArrayLength)
+	   && (_pageState[pageNo + count] == UNTOUCHED)) {
+      count++;
+    }
+    _nextRead = pageNo + count;
+    return count;
+#else
+    return 1;
+#endif
+  }
+
+  /// @brief Add the pages written without faulting to the dirtied set.
+  void collectWrites (void) {
+    if (!_tracking) {
+      return;
+    }
+    // Every page the app could write without faulting is in the read
+    // set -- or sticky, if it was written between transactions (e.g.,
+    // by stdio, around I/O) -- so we just ask about each run of those.
+    collectWrites (_read);
+#if USE_STICKY_READS
+    collectWrites (_sticky);
+#endif
+  }
+
+  /// @brief Stop tracking reads: from now on, every page we have not
+  /// written is readable, and we only check the pages we write for
+  /// conflicts.
+  /// @note Only call this between transactions.
+  void setSnapshot (void) {
+    if (_snapshot) {
+      return;
+    }
+    _snapshot = true;
+#if USE_STICKY_READS
+    _sticky.clear();
+#endif
+    if (!_remapAll && !_direct) {
+      mprotect (base(), size(), PROT_READ);
+    }
+    _snapshotVersions = (int *)
+      mmap (NULL,
+	    VersionArrayLength * sizeof(int),
+	    PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+	    -1,
+	    0);
+    if (_snapshotVersions == MAP_FAILED) {
+      ::abort();
+    }
+    // (So that the first snapshotVersions() copies every superblock.)
+    for (int b = 0; b < NumSuperblocks; b++) {
+      _snapshotSummaries[b] = _persistentSummaries[b] - 1;
+    }
+  }
+
+  /// @brief Get ready to run in a newly-forked child.
+  void forked (void) {
+    _tracker.forked();
+    if (!_tracking) {
+      return;
+    }
+    _tracking = _tracker.track (base(), size());
+#if USE_STICKY_READS
+    // Our sticky pages are writable, but whatever the parent armed
+    // to catch writes to them is gone: arm it again (or, failing
+    // that, let writes fault).
+    for (typename pageSetType::iterator i = _sticky.begin(); i != _sticky.end(); ++i) {
+      if (isRunStart (_sticky, *i)) {
+	char * start = (char *) base() + *i * BlockSize;
+	size_t len = (runEnd (_sticky, *i) - *i) * BlockSize;
+	if (_tracking) {
+	  _tracker.protect (start, len);
+	} else {
+	  mprotect (start, len, PROT_READ);
+	}
+      }
+    }
+#endif
+  }
+
+
   /// @brief Record a read to this location.
   void recordRead (void * addr) {
     if (inRange (addr)) {
@@ -200,9 +489,21 @@ public:
       // Compute the page address of this item,
       // and mark the page as having been read.
       int pageNo = computePage (index);
+      int block = pageNo / SuperblockPages;
+      if (_readBlocks.insert (block)) {
+	// Read the summary before the version number, so any commit
+	// to this superblock from now on changes the summary.
+	_localSummaries[block] = _persistentSummaries[block];
+      }
       // Force a read of the version number.
       _localVersions[pageNo] = _persistentVersions[pageNo];
       _read.insert (pageNo);
+      _pageState[pageNo] = READABLE;
+#if USE_VALUE_VALIDATION
+      // Freeze the page only after reading its version: if a commit
+      // sneaks in between, the version will not match.
+      freezePage (pageNo);
+#endif
     }
   }
 
@@ -213,9 +514,38 @@ public:
       // Compute the page address of this item,
       // and mark the page as being dirtied (so we commit it later).
       int pageNo = computePage (index);
+      if (_direct) {
+	// We are writing the shared copy. Anyone who already read this
+	// page must find out before we change it (and anyone who reads
+	// it from now on, when we are done: see endDirect()).
+	if (_dirtied.insert (pageNo)) {
+	  getLock().lock();
+	  (*_commitClock)++;
+	  memoryBarrier();
+	  _persistentVersions[pageNo]++;
+	  _persistentSummaries[pageNo / SuperblockPages]++;
+	  memoryBarrier();
+	  (*_commitClock)++;
+	  getLock().unlock();
+	}
+	return;
+      }
+#if USE_DIFF_COMMIT
+      if (_dirtied.insert (pageNo)) {
+	makeTwin (pageNo);
+      }
+#else
       _dirtied.insert (pageNo);
+#endif
+      _pageState[pageNo] = WRITABLE;
       // Just to be on the safe side, we insert the page into the read set as well.
-      _read.insert (pageNo);
+      if (_read.insert (pageNo)) {
+	// We did not see this page get read, so we cannot tell whether
+	// the superblock summary predates the read: never trust it.
+	int block = pageNo / SuperblockPages;
+	_readBlocks.insert (block);
+	_localSummaries[block] = _persistentSummaries[block] - 1;
+      }
     }
   }
 
@@ -223,15 +553,40 @@ public:
   /// @brief Start a transaction.
   void begin (void) {
     // Clear the read and write (dirtied) page sets.
-    _read.clear();
-    _dirtied.clear();
+    forgetTouched();
+    // The (empty) read set is trivially valid as of now -- unless a
+    // commit is in progress, in which case the clock will not match.
+    _validatedClock = *_commitClock & ~1U;
+    _stale = false;
+    if (_snapshot && !_direct) {
+      snapshotVersions();
+    }
+#if USE_STICKY_READS
+    carrySticky();
+#endif
+  }
+
+  /// @brief Start catching the writes that do not fault.
+  /// @note Call this after begin() -- and, since arming the tracker
+  /// can forget writes anywhere in the process, only once every
+  /// region has begun (and so collected the writes to its sticky
+  /// pages).
+  void track (void) {
+    if (_tracking) {
+      _tracker.arm();
+    }
   }
   
 
   /// @brief Fail a transaction (reverting local changes).
   /// @note This should happen only after calling consistent().
   void abort (void) {
-    // Revert the local copies to the shared versions.
+#if USE_DIFF_COMMIT
+    discardTwins();
+#endif
+    // Find all the pages we wrote (so that they do not stay sticky),
+    // and revert the local copies to the shared versions.
+    collectWrites();
     updateAll();
   }
 
@@ -242,7 +597,7 @@ public:
     if (!noReads) {
       printf ("we read something.\n");
       
-      for (pageSetType::iterator i = _read.begin();
+      for (typename pageSetType::iterator i = _read.begin();
 	   i != _read.end();
 	   ++i) {
 	int pageNo = *i;
@@ -271,59 +626,98 @@ public:
   bool consistent (void) {
     assert (isLocked());
 
-    memoryBarrier();
-
-    // Check to see if every version of any page that's been read is
-    // the most current version number.
-
-    bool wasConsistent = true;
-
-    pageSetType::iterator i;
+    if (_direct) {
+      return true;
+    }
+    if (_stale) {
+      return false;
+    }
 
-    for (i = _read.begin();
-	 i != _read.end();
-	 ++i) {
-      int pageNo = *i;
+    memoryBarrier();
 
-      if (_persistentVersions[pageNo] != _localVersions[pageNo]) {
+    // If nothing has committed since we last checked, nothing we
+    // read can have changed.
+    unsigned int now = *_commitClock;
+    if (now == _validatedClock) {
+      return true;
+    }
 
-	// Our view is not consistent.
+    bool wasConsistent = checkReadSet (true);
+    if (wasConsistent) {
+      _validatedClock = now;
+    }
 
-#if 0 // !defined(NDEBUG)
-	printf ("inconsistent page = %d (addr = [%p])\n", pageNo, (void *) ((pageNo * 4096) + base()));
-	printf ("my version = %d, committed version = %d\n",
-		_localVersions[pageNo],
-		_persistentVersions[pageNo]);
-#endif
+    memoryBarrier();
 
-	bool different = true; // (memcmp ((char *) _persistentMemory + xdefines::PageSize * pageNo, (char *) _transientMemory + xdefines::PageSize * pageNo, xdefines::PageSize) != 0);
+    return wasConsistent;
+  }
 
-	if (different) {
 
-#if 0
-	  printf ("diffs:\n");
-	  for (int i = 0; i < xdefines::PageSize; i++) {
-	    if (_transientMemory[pageNo * xdefines::PageSize + i] !=
-		_persistentMemory[pageNo * xdefines::PageSize + i]) {
-	      printf ("committed = %d, mine = %d\n",
-		      _persistentMemory[pageNo * xdefines::PageSize + i],
-		      _transientMemory[pageNo * xdefines::PageSize + i]);
-	      
-	    }
-	  }
-#endif
-
-	  wasConsistent = false;
-	  break;
-	} else {
-	  // No diffs - update local version number.
-	  _localVersions[pageNo] = _persistentVersions[pageNo];
+  /// @return true iff our version of the world is consistent.
+  /// @note Does not take the lock. Like a seqlock reader, it re-runs
+  /// the check if a commit overlapped it, and only falls back to the
+  /// lock if commits keep getting in the way.
+  bool validate (void) {
+    if (_direct) {
+      return true;
+    }
+    if (_stale) {
+      return false;
+    }
+    for (int tries = 0; tries < MaxValidateRetries; tries++) {
+      unsigned int before = *_commitClock;
+      if (before == _validatedClock) {
+	return true;
+      }
+      if (before & 1) {
+	// A commit is under way.
+	sched_yield();
+	continue;
+      }
+      memoryBarrier();
+      // Leave our local versions alone: what we compare against
+      // might be torn by a concurrent commit.
+      bool wasConsistent = checkReadSet (false);
+      memoryBarrier();
+      if (*_commitClock == before) {
+	if (wasConsistent) {
+	  _validatedClock = before;
 	}
+	return wasConsistent;
       }
     }
+    lock();
+    bool wasConsistent = consistent();
+    unlock();
+    return wasConsistent;
+  }
 
-    memoryBarrier();
 
+  /// @return false iff we can tell right now (without waiting) that
+  /// something we read has changed.
+  /// @note Cheap unless something has committed since we last checked.
+  bool validateNow (void) {
+    if (_direct) {
+      return true;
+    }
+    if (_stale) {
+      return false;
+    }
+    unsigned int before = *_commitClock;
+    if ((before == _validatedClock) || (before & 1)) {
+      // Nothing new, or a commit is under way (so we check later).
+      return true;
+    }
+    memoryBarrier();
+    bool wasConsistent = checkReadSet (false);
+    memoryBarrier();
+    if (*_commitClock != before) {
+      // A commit overlapped the check, so we cannot trust it.
+      return true;
+    }
+    if (wasConsistent) {
+      _validatedClock = before;
+    }
     return wasConsistent;
   }
 
@@ -333,28 +727,75 @@ public:
   void commit (void) {
     assert (isLocked());
 
-    memoryBarrier();
+    if (_direct) {
+      endDirect();
+      return;
+    }
 
-    // Commit any local modifications.
-    for (pageSetType::iterator i = _dirtied.begin();
+    collectWrites();
+
+    // True once we have actually changed something.
+    bool publishing = false;
+
+    // Commit any local modifications, a run of consecutive pages at
+    // a time, so that each stretch of changed pages takes one copy.
+    for (typename pageSetType::iterator i = _dirtied.begin();
 	 i != _dirtied.end();
 	 ++i) {
 
-      // Write the page into persistent memory.
-      int pageNo = *i;
+      if (!isRunStart (_dirtied, *i)) {
+	continue;
+      }
+      int last = runEnd (_dirtied, *i);
+
+      // The first of the changed pages we have yet to copy (if any).
+      int pending = -1;
+
+      for (int pageNo = *i; pageNo < last; pageNo++) {
+
+	// Skip pages that we wrote but did not change (silent stores):
+	// bumping their versions would needlessly abort their readers.
+#if USE_DIFF_COMMIT
+	bool unchanged = blockEqual ((char *) _transientMemory + BlockSize * pageNo,
+				     twin (pageNo));
+#else
+	// (We are consistent, so the committed copy is what we read.)
+	bool unchanged = blockEqual ((char *) _transientMemory + BlockSize * pageNo,
+				     (char *) _persistentMemory + BlockSize * pageNo);
+#endif
+	if (unchanged) {
+	  if (pending != -1) {
+	    copyPages (pending, pageNo - pending);
+	    pending = -1;
+	  }
+	  continue;
+	}
+
+	if (!publishing) {
+	  // Make the clock odd while we write, so lock-free validators
+	  // know to wait and retry.
+	  (*_commitClock)++;
+	  memoryBarrier();
+	  publishing = true;
+	}
 
-      memcpy ((char *) _persistentMemory + xdefines::PageSize * pageNo,
-	      (char *) _transientMemory + xdefines::PageSize * pageNo,
-	      xdefines::PageSize);
-      
-      // This is now a new version, so increment our local version
-      // number and record that to the persistent store.
-      
-      assert (pageNo >= 0);
-      assert (pageNo < VersionArrayLength);
-      
-      _persistentVersions[pageNo] = _localVersions[pageNo] + 1;
-      
+	// Write the page into persistent memory.
+#if USE_DIFF_COMMIT
+	// Merge in just the bytes we changed.
+	writeBlockDiffs ((char *) _transientMemory + BlockSize * pageNo,
+			 twin (pageNo),
+			 (char *) _persistentMemory + BlockSize * pageNo);
+	bumpVersions (pageNo, 1);
+#else
+	if (pending == -1) {
+	  pending = pageNo;
+	}
+#endif
+      }
+
+      if (pending != -1) {
+	copyPages (pending, last - pending);
+      }
     }
 
     // Write out all changes to the persistent memory and versions.
@@ -364,13 +805,20 @@ public:
     msync (_persistentVersions, NElts * sizeof(int), MS_SYNC);
 #endif
 
-    // Dump the now-unnecessary page frames, reducing space overhead.
-    pageSetType::iterator i;
-    for (i = _dirtied.begin(); i != _dirtied.end(); ++i) {
-      updatePage (*i);
-    }
+#if USE_DIFF_COMMIT
+    discardTwins();
+#endif
 
-    memoryBarrier();
+    // Dump the now-unnecessary page frames, reducing space overhead,
+    // and protect every page we touched again, so that the next
+    // transaction sees (and tracks) them afresh.
+    discardTouched();
+
+    if (publishing) {
+      memoryBarrier();
+      // Done: the clock is even again.
+      (*_commitClock)++;
+    }
   }
 
 
@@ -386,13 +834,13 @@ public:
     // How this would work: we could read lock the whole region.
     // Then, we could write lock selectively (page n => write lock 0-n).
     // An alternative would be to do speculative execution...
-    _lock.lock();
+    getLock().lock();
     _isLocked = true;
   }
 
   /// @brief Unlock the store.
   void unlock (void) {
-    _lock.unlock();
+    getLock().unlock();
     _isLocked = false;
   }
 
@@ -409,17 +857,184 @@ public:
 #endif
   }
 
-  /// @brief Update every page frame from the backing file.
-  void updateAll (void) {
-    // Unmap and remap the transient memory as protected.
-    madvise ((caddr_t) _localVersions, VersionArrayLength, MADV_DONTNEED);
+  /// @brief Stop speculating: from now on, write straight to the
+  /// persistent memory (until the next commit).
+  /// @note Requires that the lock be held, and that everything
+  /// written so far has been committed. Until the next commit, nobody
+  /// else may commit (see directElsewhere()): we do not know what we
+  /// read, so we could not tell if they changed it.
+  /// @arg unprotected  true iff no other process is running, so we
+  /// need not even catch the pages we write (see rearm()).
+  void beginDirect (bool unprotected = false) {
+    assert (isLocked());
+    assert (!_direct);
+    forgetTouched();
+    // Every page is readable from now on, so we will have to protect
+    // them all again afterwards.
+    _remapAll = true;
+#if USE_STICKY_READS
+    _sticky.clear();
+#endif
+    *_directWriter = 1;
+    memoryBarrier();
+    // Map the shared copy, read-only so that we still catch (and
+    // can version) the pages we write -- unless nobody is left who
+    // could have read them.
     munmap (_transientMemory, NElts * sizeof(Type));
     mmap (_transientMemory,
 	  NElts * sizeof(Type),
-	  PROT_NONE, // PROT_READ | PROT_WRITE | PROT_EXEC,
-	  MAP_PRIVATE | MAP_FIXED,
+	  unprotected ? (PROT_READ | PROT_WRITE) : PROT_READ,
+	  MAP_SHARED | MAP_FIXED,
 	  _backingFd,
 	  0);
+    _direct = true;
+    _unprotected = unprotected;
+    _tracking = false;
+  }
+
+  /// @return true iff we are writing straight to persistent memory.
+  bool isDirect (void) const {
+    return _direct;
+  }
+
+  /// @return true iff another process is writing straight to
+  /// persistent memory (so we must not commit yet).
+  /// @note Requires that the lock be held.
+  bool directElsewhere (void) const {
+    assert (isLocked());
+    return (*_directWriter && !_direct);
+  }
+
+  /// @return true iff we are writing straight to persistent memory
+  /// without tracking anything at all.
+  bool isUnprotected (void) const {
+    return _unprotected;
+  }
+
+  /// @brief Protect memory again at the next commit.
+  /// @note Unprotected writes never bump any versions, which is only
+  /// safe while nobody else runs; call this before spawning anyone.
+  void rearm (void) {
+    _unprotected = false;
+  }
+
+  /// @return the number of ints stage() needs to describe this transaction.
+  int stagedInts (void) const {
+    return 2 + 2 * _read.size() + _dirtied.size();
+  }
+
+  /// @return the number of (system) pages stage() copies.
+  int stagedPages (void) const {
+    return _dirtied.size() * PagesPerBlock;
+  }
+
+  /// @return the length (in ints) of a description made by stage().
+  int stagedLength (const int * meta) const {
+    return 2 + 2 * meta[0] + meta[1];
+  }
+
+  /// @brief Save everything needed to commit this transaction later,
+  /// from some other process.
+  /// @note The description holds the number of pages read and
+  /// written, then a (page, version) pair for each page read, then
+  /// the number of each page written, whose contents go in pages.
+  void stage (int * meta, char * pages) {
+    meta[0] = _read.size();
+    meta[1] = _dirtied.size();
+    int * p = &meta[2];
+    typename pageSetType::iterator i;
+    for (i = _read.begin(); i != _read.end(); ++i) {
+      *p++ = *i;
+      *p++ = _localVersions[*i];
+    }
+    // (A run of consecutive pages at a time, so that applyStaged()
+    // can copy each run back at once.)
+    for (i = _dirtied.begin(); i != _dirtied.end(); ++i) {
+      if (!isRunStart (_dirtied, *i)) {
+	continue;
+      }
+      int last = runEnd (_dirtied, *i);
+      for (int pageNo = *i; pageNo < last; pageNo++) {
+	*p++ = pageNo;
+      }
+      memcpy (pages,
+	      (char *) _transientMemory + BlockSize * *i,
+	      (last - *i) * BlockSize);
+      pages += (last - *i) * BlockSize;
+    }
+  }
+
+  /// @return true iff every page a staged transaction read is still
+  /// at the version it read.
+  /// @note Requires that the lock be held.
+  bool validateStaged (const int * meta) {
+    assert (isLocked());
+    const int * p = &meta[2];
+    for (int i = 0; i < meta[0]; i++, p += 2) {
+      if (_persistentVersions[p[0]] != p[1]) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  /// @brief Commit a staged transaction (which must be valid).
+  /// @note Requires that the lock be held.
+  /// @return the end of the staged pages.
+  const char * applyStaged (const int * meta, const char * pages) {
+    assert (isLocked());
+    const int * written = &meta[2 + 2 * meta[0]];
+    bool publishing = false;
+    // The first of a run of changed pages we have yet to copy (if
+    // any), and where its contents are.
+    int pending = -1;
+    const char * pendingPages = NULL;
+    int count = 0;
+    for (int i = 0; i < meta[1]; i++, pages += BlockSize) {
+      int pageNo = written[i];
+      char * dest = (char *) _persistentMemory + BlockSize * pageNo;
+      bool unchanged = blockEqual (pages, dest);
+      if ((pending != -1) && (unchanged || (pageNo != pending + count))) {
+	memcpy ((char *) _persistentMemory + BlockSize * pending, pendingPages, count * BlockSize);
+	bumpVersions (pending, count);
+	pending = -1;
+      }
+      if (unchanged) {
+	continue;
+      }
+      if (!publishing) {
+	(*_commitClock)++;
+	memoryBarrier();
+	publishing = true;
+      }
+      if (pending == -1) {
+	pending = pageNo;
+	pendingPages = pages;
+	count = 0;
+      }
+      count++;
+    }
+    if (pending != -1) {
+      memcpy ((char *) _persistentMemory + BlockSize * pending, pendingPages, count * BlockSize);
+      bumpVersions (pending, count);
+    }
+    if (publishing) {
+      memoryBarrier();
+      (*_commitClock)++;
+    }
+    return pages;
+  }
+
+  /// @brief Update every page frame from the backing file.
+  /// @note Only the pages we touched can differ from it (or be
+  /// accessible), so only those get updated.
+  void updateAll (void) {
+    if (_direct) {
+      // (Also calls us back.)
+      endDirect();
+      return;
+    }
+    discardTouched();
   }
 
 
@@ -430,15 +1045,318 @@ public:
 
 private:
 
+  /// @return a descriptor for a new, empty, anonymous file.
+  /// @note The file lives in memory (memfd) unless GRACE_TMPDIR names
+  /// a directory to put it in (e.g., a tmpfs or hugetlbfs mount). If
+  /// neither works, it goes in the current directory (which had
+  /// better not be NFS-mounted...).
+  static int makeFile (const char * name) {
+    const char * dir = getenv ("GRACE_TMPDIR");
+#if defined(linux) && defined(SYS_memfd_create)
+    if (dir == NULL) {
+      int fd = syscall (SYS_memfd_create, name, MFD_CLOEXEC);
+      if (fd != -1) {
+	return fd;
+      }
+    }
+#endif
+    char fname[PATH_MAX];
+    snprintf (fname, sizeof(fname), "%s%s%sXXXXXX",
+	      dir ? dir : "", dir ? "/" : "", name);
+    int fd = mkstemp (fname);
+    if (fd != -1) {
+      // Get rid of the file when we exit.
+      unlink (fname);
+    }
+    return fd;
+  }
+
   inline int computePage (int index) {
-    return (index * sizeof(Type)) / xdefines::PageSize;
+    return (index * sizeof(Type)) / BlockSize;
+  }
+
+  /// @return true iff the two blocks have identical contents.
+  static bool blockEqual (const char * a, const char * b) {
+    for (int i = 0; i < BlockSize; i += xdefines::PageSize) {
+      if (!xpagekernels::equal (a + i, b + i)) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+#if USE_DIFF_COMMIT
+  /// @brief Write the bytes of local that differ from twin into dest
+  /// (a block at a time).
+  static void writeBlockDiffs (const char * local, const char * twin, char * dest) {
+    for (int i = 0; i < BlockSize; i += xdefines::PageSize) {
+      xpagekernels::writeDiffs (local + i, twin + i, dest + i);
+    }
+  }
+
+  /// @return true iff some byte of the block was changed both
+  /// locally and in the committed copy.
+  static bool blockConflicts (const char * local, const char * twin, const char * committed) {
+    for (int i = 0; i < BlockSize; i += xdefines::PageSize) {
+      if (xpagekernels::conflicts (local + i, twin + i, committed + i)) {
+	return true;
+      }
+    }
+    return false;
+  }
+#endif
+
+
+  /// @return true iff every page we read is still at the version we read.
+  /// @arg updateVersions  if true, catch up the local version of
+  ///                      pages that changed without conflicting.
+  bool checkReadSet (bool updateVersions) {
+    for (typename blockSetType::iterator b = _readBlocks.begin();
+	 b != _readBlocks.end();
+	 ++b) {
+      int block = *b;
+      int summary = _persistentSummaries[block];
+      if (summary == _localSummaries[block]) {
+	// Nothing in this superblock has committed since we started
+	// reading it.
+	continue;
+      }
+      if (!checkSuperblock (block, updateVersions)) {
+	return false;
+      }
+      if (updateVersions) {
+	_localSummaries[block] = summary;
+      }
+    }
+    return true;
   }
 
+  /// @return true iff every page we read in this superblock is still
+  /// at the version we read.
+  bool checkSuperblock (int block, bool updateVersions) {
+    bool wasConsistent = true;
+
+    const int firstWord = block * WordsPerSuperblock;
+    int lastWord = firstWord + WordsPerSuperblock;
+    if (lastWord > VersionArrayWords) {
+      lastWord = VersionArrayWords;
+    }
+
+    for (int w = firstWord; (w < lastWord) && wasConsistent; w++) {
+      unsigned int readPages = _read.word (w);
+      if (!readPages) {
+	continue;
+      }
+
+      // Compare the versions of a run of pages at once, and just
+      // look at the ones we read whose versions have moved on.
+      int firstPage = w * pageSetType::PagesPerWord;
+      unsigned int changed = readPages &
+	xpagekernels::differingInts (&_localVersions[firstPage],
+				     &_persistentVersions[firstPage]);
+
+      while (changed) {
+	int pageNo = firstPage + __builtin_ctz (changed);
+	changed &= changed - 1;
 
-  /// @brief Update the given page frame from the backing file.
-  void updatePage (int pageNo) {
-    madvise (_transientMemory + pageNo * xdefines::PageSize, xdefines::PageSize, MADV_DONTNEED);
-    mprotect (_transientMemory + pageNo * xdefines::PageSize, xdefines::PageSize, PROT_NONE);
+	// Our view is not consistent.
+
+#if 0 // !defined(NDEBUG)
+	printf ("inconsistent page = %d (addr = [%p])\n", pageNo, (void *) ((pageNo * 4096) + base()));
+	printf ("my version = %d, committed version = %d\n",
+		_localVersions[pageNo],
+		_persistentVersions[pageNo]);
+#endif
+
+	bool different = true;
+
+#if USE_VALUE_VALIDATION
+	// Our copy of a page we only read is frozen as of when we read
+	// it, so if it still matches the committed copy, nothing we
+	// saw has changed.
+	if (!_dirtied.contains (pageNo)) {
+	  different = !blockEqual ((char *) _transientMemory + BlockSize * pageNo,
+				   (char *) _persistentMemory + BlockSize * pageNo);
+	}
+#endif
+
+#if USE_DIFF_COMMIT
+	// A page we wrote only conflicts if someone else committed
+	// changes to the very bytes we changed.
+	if (_dirtied.contains (pageNo)) {
+	  different = blockConflicts ((char *) _transientMemory + BlockSize * pageNo,
+				      twin (pageNo),
+				      (char *) _persistentMemory + BlockSize * pageNo);
+	}
+#endif
+
+	if (different) {
+
+#if 0
+	  printf ("diffs:\n");
+	  for (int i = 0; i < BlockSize; i++) {
+	    if (_transientMemory[pageNo * BlockSize + i] !=
+		_persistentMemory[pageNo * BlockSize + i]) {
+	      printf ("committed = %d, mine = %d\n",
+		      _persistentMemory[pageNo * BlockSize + i],
+		      _transientMemory[pageNo * BlockSize + i]);
+	      
+	    }
+	  }
+#endif
+
+	  wasConsistent = false;
+	  break;
+	} else if (updateVersions) {
+	  // No diffs - update local version number.
+	  _localVersions[pageNo] = _persistentVersions[pageNo];
+	}
+      }
+    }
+
+    return wasConsistent;
+  }
+
+  /// @brief Drop our copies of the pages we touched, protect them
+  /// again, and forget that we touched them.
+  void discardTouched (void) {
+    if (_remapAll) {
+      // Everything might be accessible: unmap and remap the
+      // transient memory as protected.
+      madvise ((caddr_t) _localVersions, VersionArrayLength * sizeof(int), MADV_DONTNEED);
+      munmap (_transientMemory, NElts * sizeof(Type));
+      mmap (_transientMemory,
+	    NElts * sizeof(Type),
+	    untouchedProtection(), // PROT_READ | PROT_WRITE | PROT_EXEC,
+	    MAP_PRIVATE | MAP_FIXED,
+	    _backingFd,
+	    0);
+      _remapAll = false;
+      _tracking = _tracker.track (base(), size());
+#if USE_STICKY_READS
+      _sticky.clear();
+#endif
+    } else {
+#if USE_STICKY_READS
+      // Pages we only read stay readable; we just drop the ones we
+      // wrote, a run of consecutive pages at a time.
+      pageSetType& discard = _dirtied;
+      _sticky.clear();
+      for (typename pageSetType::iterator i = _read.begin(); i != _read.end(); ++i) {
+	if (!_dirtied.contains (*i)) {
+	  _sticky.insert (*i);
+	}
+      }
+#else
+      // Every page we dirtied is in the read set too, so we just walk
+      // it, a run of consecutive pages at a time.
+      pageSetType& discard = _read;
+#endif
+      for (typename pageSetType::iterator i = discard.begin(); i != discard.end(); ++i) {
+	if (isRunStart (discard, *i)) {
+	  updatePages (*i, runEnd (discard, *i) - *i);
+	}
+      }
+    }
+    forgetTouched();
+    _tracker.disarm();
+  }
+
+#if USE_STICKY_READS
+  /// @brief Start the read set with the pages that were only read
+  /// last time (which are still readable), unless their versions
+  /// have moved on since -- those we protect again, since the app
+  /// would not see them at the versions we recorded.
+  void carrySticky (void) {
+    // The app may have written some of them since the last
+    // transaction without our seeing it: those are part of this one.
+    collectWrites();
+    // (A run of consecutive pages at a time, so that we can protect
+    // runs of stale ones at once.)
+    for (typename pageSetType::iterator i = _sticky.begin(); i != _sticky.end(); ++i) {
+      if (!isRunStart (_sticky, *i)) {
+	continue;
+      }
+      int last = runEnd (_sticky, *i);
+      // The first of the stale pages we have yet to protect (if any).
+      int stale = -1;
+      for (int pageNo = *i; pageNo < last; pageNo++) {
+	bool isStale = false;
+	if (!_dirtied.contains (pageNo)) {
+	  int block = pageNo / SuperblockPages;
+	  if (_readBlocks.insert (block)) {
+	    // As in recordRead(): the summary before the version.
+	    _localSummaries[block] = _persistentSummaries[block];
+	  }
+	  if (_persistentVersions[pageNo] != _localVersions[pageNo]) {
+	    isStale = true;
+	  } else {
+	    _read.insert (pageNo);
+	    _pageState[pageNo] = READABLE;
+	  }
+	}
+	if (isStale) {
+	  if (stale == -1) {
+	    stale = pageNo;
+	  }
+	} else if (stale != -1) {
+	  updatePages (stale, pageNo - stale);
+	  stale = -1;
+	}
+      }
+      if (stale != -1) {
+	updatePages (stale, last - stale);
+      }
+    }
+    _sticky.clear();
+  }
+#endif
+
+  /// @brief Empty the page sets, and mark their pages untouched.
+  void forgetTouched (void) {
+    // (Every page we dirtied is in the read set, too.)
+    for (typename pageSetType::iterator i = _read.begin(); i != _read.end(); ++i) {
+      _pageState[*i] = UNTOUCHED;
+    }
+    _read.clear();
+    _readBlocks.clear();
+    _dirtied.clear();
+  }
+
+  /// @return the protection for pages not yet touched in a transaction.
+  inline int untouchedProtection (void) const {
+    // Unless we track reads, only writes need to fault.
+    return _snapshot ? PROT_READ : PROT_NONE;
+  }
+
+  /// @brief Note the version of every page as of now (the start of a
+  /// transaction in snapshot mode), copying just the superblocks that
+  /// have changed since last time.
+  /// @note A version may be newer than the start of the transaction,
+  /// but never newer than the contents the app can read.
+  void snapshotVersions (void) {
+    for (int b = 0; b < NumSuperblocks; b++) {
+      int summary = _persistentSummaries[b];
+      if (summary == _snapshotSummaries[b]) {
+	continue;
+      }
+      // As in recordRead(): the summary before the versions.
+      memoryBarrier();
+      int first = b * SuperblockPages;
+      int count = SuperblockPages;
+      if (first + count > VersionArrayLength) {
+	count = VersionArrayLength - first;
+      }
+      memcpy (&_snapshotVersions[first], &_persistentVersions[first], count * sizeof(int));
+      _snapshotSummaries[b] = summary;
+    }
+  }
+
+  /// @brief Update the given page frames from the backing file.
+  void updatePages (int pageNo, int count) {
+    char * start = (char *) _transientMemory + pageNo * BlockSize;
+    madvise (start, count * BlockSize, MADV_DONTNEED);
+    mprotect (start, count * BlockSize, untouchedProtection());
 
 #if 0
     printf ("updating: %d - local = %d, persistent = %d\n",
@@ -446,12 +1364,207 @@ private:
 #endif
   }
 
+  /// @brief Copy the given (changed) pages to the persistent memory.
+  void copyPages (int pageNo, int count) {
+    memcpy ((char *) _persistentMemory + BlockSize * pageNo,
+	    (char *) _transientMemory + BlockSize * pageNo,
+	    count * BlockSize);
+    bumpVersions (pageNo, count);
+  }
+
+  /// @brief Mark the given pages, now written, as new versions.
+  /// @note Only once their contents are in place: a reader that sees
+  /// the new version of a page must see the new contents too.
+  void bumpVersions (int pageNo, int count) {
+    // (Our local version can lag behind the persistent one if someone
+    // else committed non-conflicting diffs.)
+    assert (pageNo >= 0);
+    assert (pageNo + count <= VersionArrayLength);
+    for (int i = pageNo; i < pageNo + count; i++) {
+      _persistentVersions[i]++;
+      _persistentSummaries[i / SuperblockPages]++;
+    }
+  }
+
+  /// @brief Publish the versions of the pages we wrote directly
+  /// (again: see recordWrite()), and go back to speculating.
+  void endDirect (void) {
+    getLock().lock();
+    (*_commitClock)++;
+    memoryBarrier();
+    for (typename pageSetType::iterator i = _dirtied.begin();
+	 i != _dirtied.end();
+	 ++i) {
+      _persistentVersions[*i]++;
+      _persistentSummaries[*i / SuperblockPages]++;
+    }
+    memoryBarrier();
+    // The clock is even again.
+    (*_commitClock)++;
+    *_directWriter = 0;
+    getLock().unlock();
+    _direct = false;
+    _unprotected = false;
+    updateAll();
+  }
+
+  /// @brief Give the app full access to a page.
+  inline void makeWritable (char * page) {
+    mprotect (page, BlockSize, PROT_READ | PROT_WRITE | PROT_EXEC);
+#if USE_POPULATE_WRITE && defined(MADV_POPULATE_WRITE)
+    if (!_direct) {
+      // Copy the page now, rather than in another (copy-on-write)
+      // fault once we return.
+      madvise (page, BlockSize, MADV_POPULATE_WRITE);
+    }
+#endif
+  }
+
+  /// @brief Give ourselves a private copy of a (writable) page.
+  inline void breakCopyOnWrite (int pageNo) {
+    // A plain page[0] = page[0] could load the byte before the fault
+    // copies the page (and so write back a stale value). An atomic
+    // add of zero faults before it reads anything. (Once for each
+    // system page in the block.)
+    for (int i = 0; i < BlockSize; i += xdefines::PageSize) {
+      __sync_fetch_and_add ((volatile char *) _transientMemory + pageNo * BlockSize + i, 0);
+    }
+  }
+
+#if USE_VALUE_VALIDATION
+  /// @brief Replace our view of a page we just read with a private
+  /// copy, so that later commits do not show through.
+  void freezePage (int pageNo) {
+    char * page = (char *) _transientMemory + pageNo * BlockSize;
+    mprotect (page, BlockSize, PROT_READ | PROT_WRITE);
+    breakCopyOnWrite (pageNo);
+    mprotect (page, BlockSize, PROT_READ);
+  }
+#endif
+
+#if USE_DIFF_COMMIT
+  /// @return the twin of the given page.
+  inline char * twin (int pageNo) {
+    return (char *) _twinMemory + pageNo * BlockSize;
+  }
+
+  /// @brief Save a pristine copy of a page we are about to write.
+  /// @note The page must already be writable.
+  void makeTwin (int pageNo) {
+    // Break copy-on-write before taking the twin, so that it matches
+    // our private copy exactly and not some later commit.
+    breakCopyOnWrite (pageNo);
+    memcpy (twin (pageNo), (char *) _transientMemory + pageNo * BlockSize, BlockSize);
+  }
+
+  /// @brief Release the physical memory behind the twins of the
+  /// dirtied pages, a run of consecutive pages at a time.
+  void discardTwins (void) {
+    for (typename pageSetType::iterator i = _dirtied.begin(); i != _dirtied.end(); ++i) {
+      if (isRunStart (_dirtied, *i)) {
+	madvise (twin (*i), (runEnd (_dirtied, *i) - *i) * BlockSize, MADV_DONTNEED);
+      }
+    }
+  }
+#endif
+
+  /// The number of system pages in each block.
+  enum { PagesPerBlock = BlockSize / xdefines::PageSize };
+
   /// The length of the version array, which has one entry per page.
-  enum { VersionArrayLength = (NElts * sizeof(Type) + xdefines::PageSize-1) / xdefines::PageSize };
+  enum { VersionArrayLength = (NElts * sizeof(Type) + BlockSize-1) / BlockSize };
+
+  /// The size of the version array, rounded up to a whole page.
+  enum { VersionArrayBytes = (VersionArrayLength * sizeof(int) + xdefines::PageSize-1) & ~(xdefines::PageSize-1) };
+
+  /// The number of pages summarized by each superblock counter (2MB worth).
+  enum { SuperblockPages = (2 * 1024 * 1024) / BlockSize };
+
+  /// The number of superblocks.
+  enum { NumSuperblocks = (VersionArrayLength + SuperblockPages - 1) / SuperblockPages };
+
+  /// The size of the summary array, rounded up to a whole page.
+  enum { SummaryArrayBytes = (NumSuperblocks * sizeof(int) + xdefines::PageSize-1) & ~(xdefines::PageSize-1) };
+
+  /// The size of the versions file: the versions, the summaries,
+  /// and the commit clock.
+  enum { VersionFileSize = VersionArrayBytes + SummaryArrayBytes + xdefines::PageSize };
+
+  /// The most pages readAhead() makes readable at once.
+  enum { MaxReadAhead = 32 };
+
+  /// How many times validate() re-runs before taking the lock.
+  enum { MaxValidateRetries = 16 };
+
+  /// The states of a page (in the current transaction).
+  enum { UNTOUCHED = 0, READABLE, WRITABLE };
 
   /// The type of read and dirtied sets.
-  typedef std::set<int, less<int>, HL::STLAllocator<int, privateheap> >
-  pageSetType;
+  typedef xpageset<VersionArrayLength> pageSetType;
+
+  /// The type of the set of superblocks we read.
+  typedef xpageset<NumSuperblocks> blockSetType;
+
+  /// The number of read set words per superblock, and overall.
+  enum { WordsPerSuperblock = SuperblockPages / pageSetType::PagesPerWord };
+  enum { VersionArrayWords = (VersionArrayLength + pageSetType::PagesPerWord - 1) / pageSetType::PagesPerWord };
+
+  /// Blocks must be whole pages, tile the region, and leave at least
+  /// a read set word per superblock (so at most 64K, a power of two).
+  typedef char blockSizeCheck[((BlockSize % xdefines::PageSize == 0)
+			       && ((BlockSize & (BlockSize - 1)) == 0)
+			       && ((NElts * sizeof(Type)) % BlockSize == 0)
+			       && (WordsPerSuperblock > 0)) ? 1 : -1];
+
+  /// @return true iff this page (in the set) starts a run of
+  /// consecutive pages in the set.
+  inline bool isRunStart (pageSetType& s, int pageNo) {
+    return (pageNo == 0) || !s.contains (pageNo - 1);
+  }
+
+  /// @return the page just after the run starting at this page.
+  inline int runEnd (pageSetType& s, int pageNo) {
+    int last = pageNo + 1;
+    while ((last < VersionArrayLength) && s.contains (last)) {
+      last++;
+    }
+    return last;
+  }
+
+  /// @brief Add the pages in this set that were written without
+  /// faulting to the dirtied set (and the read set).
+  void collectWrites (pageSetType& s) {
+    enum { MaxRuns = 64 };
+    typename writeTrackerType::run runs[MaxRuns];
+    for (typename pageSetType::iterator i = s.begin(); i != s.end(); ++i) {
+      int first = *i;
+      if (!isRunStart (s, first)) {
+	continue;
+      }
+      int last = runEnd (s, first);
+      char * start = (char *) base() + first * BlockSize;
+      char * end = (char *) base() + last * BlockSize;
+      while (start < end) {
+	int n = _tracker.written (start, end, runs, MaxRuns, &start);
+	for (int r = 0; r < n; r++) {
+	  // (The tracker reports pages, which may be parts of blocks.)
+	  int from = ((char *) runs[r].start - (char *) base()) / BlockSize;
+	  int to = ((char *) runs[r].end - (char *) base() + BlockSize - 1) / BlockSize;
+	  for (int pageNo = from; pageNo < to; pageNo++) {
+	    _dirtied.insert (pageNo);
+	    _pageState[pageNo] = WRITABLE;
+	    if (_read.insert (pageNo)) {
+	      // A sticky page: its version is the one we read, but the
+	      // summary is not, so never trust the summary.
+	      int block = pageNo / SuperblockPages;
+	      _readBlocks.insert (block);
+	      _localSummaries[block] = _persistentSummaries[block] - 1;
+	    }
+	  }
+	}
+      }
+    }
+  }
 
   /// True iff the lock is currently held.
   bool _isLocked;
@@ -465,17 +1578,39 @@ private:
   /// A map of read pages.
   pageSetType _read;
 
+  /// The superblocks holding pages we read.
+  blockSetType _readBlocks;
+
   /// A map of dirtied pages.
   pageSetType _dirtied;
 
+#if USE_STICKY_READS
+  /// The pages left readable by the last transaction.
+  pageSetType _sticky;
+#endif
+
+  /// The state of every page, so the fault handler can classify a
+  /// fault with a single load. (Pages written directly stay UNTOUCHED.)
+  unsigned char _pageState[VersionArrayLength];
+
   /// The file descriptor for the backing store.
   int _backingFd;
 
   /// The file descriptor for the versions.
   int _versionsFd;
 
+#if USE_SHARED_COMMIT_LOCK
+  inline xplock& getLock (void) {
+    return xplock::commitLock();
+  }
+#else
+  inline xplock& getLock (void) {
+    return _lock;
+  }
+
   /// A lock that protects the file.
   xplock _lock;
+#endif
 
   /// The transient (not yet backed) memory.
   Type * _transientMemory;
@@ -489,8 +1624,67 @@ private:
   /// The version numbers that are backed to disk.
   int * _persistentVersions;
 
+  /// Per-superblock counts of committed pages (shared).
+  int * _persistentSummaries;
+
+  /// The summaries as of when we started reading each superblock.
+  int _localSummaries[NumSuperblocks];
+
+  /// Shared count of commit starts and ends: odd while a commit is
+  /// in progress.
+  volatile unsigned int * _commitClock;
+
+  /// Shared flag: set while some process writes straight to
+  /// persistent memory (see beginDirect()).
+  volatile unsigned int * _directWriter;
+
+  /// The commit clock as of when our read set was last known valid.
+  unsigned int _validatedClock;
+
+#if USE_DIFF_COMMIT
+  /// Pristine copies of dirtied pages, as of their first write.
+  Type * _twinMemory;
+#endif
+
   bool _initialized;
 
+  /// True iff we are writing straight to persistent memory.
+  bool _direct;
+
+  /// True iff we are doing so with every page writable (see beginDirect()).
+  bool _unprotected;
+
+  /// Finds pages written without faulting (if _tracking).
+  writeTrackerType _tracker;
+
+  /// True iff the tracker is tracking writes to the transient memory.
+  bool _tracking;
+
+  /// Where the next read would be if the app keeps reading in order.
+  int _nextRead;
+
+  /// How many pages to read ahead on the next in-order read.
+  int _readAhead;
+
+  /// True iff we only track (and check) writes.
+  bool _snapshot;
+
+  /// In snapshot mode, every page's version as of the start of the
+  /// transaction (see snapshotVersions()).
+  int * _snapshotVersions;
+
+  /// The summaries as of when we last copied each superblock's versions.
+  int _snapshotSummaries[NumSuperblocks];
+
+  /// True iff we wrote a page (in snapshot mode) that someone
+  /// committed after we began: we cannot commit.
+  bool _stale;
+
+  /// True iff pages we did not track might be accessible (as they
+  /// are to begin with, and after writing directly), so that
+  /// updating means remapping everything.
+  bool _remapAll;
+
 };
 
 
@@ -2,138 +2,188 @@
 #define _XPLOCK_H_
 
 #if !defined(_WIN32)
-#include <pthread.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #endif
 
-#include <fcntl.h>
+#if defined(linux)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <new>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "xatomic.h"
+
 /**
  * @class xplock
  * @brief A cross-process lock.
  *
+ * The lock word lives in anonymous shared memory (created before any
+ * fork), so no files or pthread internals are involved. Acquiring
+ * spins briefly -- adaptively, based on how long recent acquisitions
+ * took -- and then sleeps in the kernel (on a futex, on Linux).
+ *
+ * The lock is recursive within a process, so that the heap and
+ * globals can share one lock (see commitLock()) and still each lock
+ * it in turn.
+ *
  * @author Emery Berger <http://www.cs.umass.edu/~emery>
  */
 
-// Use secret hidden APIs to avoid mallocs...
-
-extern "C" {
-
-#if defined(sparc)
-
-#define WRAP(x) _##x
-  void _pthread_mutex_init (void *, void *);
-  void _pthread_mutex_lock (void *);
-  void _pthread_mutex_unlock (void *);
-
-#elif defined(__APPLE__)
-
-  //  #define WRAP(x) _new_##x
-  //  void _new_pthread_mutex_init (void *, void *);
-  //  void _new_pthread_mutex_lock (void *);
-  //  void _new_pthread_mutex_unlock (void *);
-#define WRAP(x) _##x
-  void _pthread_mutex_init (void *, void *);
-  void _pthread_mutex_lock (void *);
-  void _pthread_mutex_unlock (void *);
-
-#else
-
-#define WRAP(x) __##x
-  //  void __pthread_mutexattr_init (void *);
-  void __pthread_mutex_init (void *, void *);
-  void __pthread_mutex_lock (void *);
-  void __pthread_mutex_unlock (void *);
-#endif
-}
-
 class xplock {
-private:
-
-  // We can use pthread-based locks, or filesystem-based locks.
-  enum { USE_PTHREAD_LOCKS = true };
-
 public:
 
-  xplock (void) {
-    char fname[255];
-
-    // Create an appropriately-sized file.
-    sprintf (fname, "/tmp/xplokXXXXXX");
-    _backingFd = mkstemp (fname);
-    int result = ftruncate (_backingFd, 4096);
-    unlink (fname);
-
-    if (result) {
-      fprintf (stderr, "Couldn't create lock file.\n");
+  xplock (void)
+    : _depth (0)
+  {
+    // Instantiate the lock structure inside a shared mmap.
+    _shared = (sharedState *) mmap (NULL, sizeof(sharedState),
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_ANONYMOUS,
+				    -1, 0);
+    if (_shared == MAP_FAILED) {
+      fprintf (stderr, "Couldn't create lock.\n");
       ::abort();
     }
+    // Anonymous memory starts out zeroed, which means unlocked.
+    _shared->spins = MinSpins;
+  }
 
-    // Instantiate the lock structure inside a shared mmap.
-    // Note: we assume that the lock is no more than 4K in size.
-    _lock = (pthread_mutex_t *) mmap (NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, _backingFd, 0);
-
-    // Set up the lock with a shared attribute.
-    // NOTE: Init below was 'wrapped' for POSIX...
-    pthread_mutexattr_init(&_attr);
-    pthread_mutexattr_setpshared (&_attr, PTHREAD_PROCESS_SHARED);
-    WRAP(pthread_mutex_init) (_lock, &_attr);
-
-    if (!USE_PTHREAD_LOCKS) {
-      // Now initialize the lock.
-      _fileLock.l_whence = SEEK_SET;
-      // Lock from start of file...
-      _fileLock.l_start = 0;
-      // to the end.
-      _fileLock.l_len = 0; 
-    }
+  /// @return the lock shared by every region.
+  static xplock& commitLock (void) {
+    static char buf[sizeof(xplock)];
+    static xplock * theLock = new (buf) xplock;
+    return *theLock;
   }
 
   /// @brief Lock the lock.
   void lock (void) {
-    if (USE_PTHREAD_LOCKS) {
-      WRAP(pthread_mutex_lock) (_lock);
-    } else {
-      _fileLock.l_type = F_WRLCK;
-      int r = fcntl (_backingFd, F_SETLK, &_fileLock);
-      if (r == -1) {
-	r = fcntl (_backingFd, F_SETLKW, &_fileLock);
+    if (_depth++ > 0) {
+      // We already hold it.
+      return;
+    }
+
+    // Fast path: uncontended.
+    int c = xatomic::compare_and_swap (&_shared->word, UNLOCKED, LOCKED);
+    if (c == UNLOCKED) {
+      _shared->acquisitions++;
+      return;
+    }
+
+    // Spin for a while, in case the holder is about to let go.
+    int maxSpins = _shared->spins;
+    int spins;
+    for (spins = 0; spins < maxSpins; spins++) {
+      pause();
+      if (_shared->word == UNLOCKED) {
+	c = xatomic::compare_and_swap (&_shared->word, UNLOCKED, LOCKED);
+	if (c == UNLOCKED) {
+	  break;
+	}
+      }
+    }
+
+    if (c != UNLOCKED) {
+      // Still held: announce that we are waiting, and sleep until
+      // we get it.
+      c = xatomic::exchange (&_shared->word, WAITING);
+      while (c != UNLOCKED) {
+	wait (WAITING);
+	_shared->sleeps++;
+	c = xatomic::exchange (&_shared->word, WAITING);
       }
     }
-    _isLocked = true;
+
+    // We hold the lock now. Move the spin limit towards however
+    // long it took us.
+    _shared->spins += (spins * 2 - _shared->spins) / 8;
+    if (_shared->spins < MinSpins) {
+      _shared->spins = MinSpins;
+    } else if (_shared->spins > MaxSpins) {
+      _shared->spins = MaxSpins;
+    }
+    _shared->acquisitions++;
+    _shared->contentions++;
   }
 
   /// @brief Unlock the lock.
   void unlock (void) {
-    if (USE_PTHREAD_LOCKS) {
-      WRAP(pthread_mutex_unlock)(_lock);
-    } else {
-      _fileLock.l_type = F_UNLCK;
-      fcntl (_backingFd, F_SETLKW, &_fileLock);
+    if (--_depth > 0) {
+      return;
+    }
+    if (xatomic::exchange (&_shared->word, UNLOCKED) == WAITING) {
+      wake();
     }
-    _isLocked = false;
+  }
+
+  /// @return the number of times any process acquired the lock.
+  unsigned long acquisitions (void) const {
+    return _shared->acquisitions;
+  }
+
+  /// @return the number of acquisitions that found the lock held.
+  unsigned long contentions (void) const {
+    return _shared->contentions;
+  }
+
+  /// @return the number of times a process slept waiting for the lock.
+  unsigned long sleeps (void) const {
+    return _shared->sleeps;
   }
 
 private:
 
-  /// True iff the lock is currently held.
-  bool _isLocked;
-  
-  /// A lock that protects the file.
-  struct flock _fileLock;
+  enum { UNLOCKED = 0, LOCKED = 1, WAITING = 2 };
 
-  /// The file descriptor for the lock.
-  int _backingFd;
+  enum { MinSpins = 16 };
+  enum { MaxSpins = 1000 };
+
+  struct sharedState {
+    /// The lock word: UNLOCKED, LOCKED, or WAITING (locked, and
+    /// maybe someone is asleep on it).
+    volatile int word;
+
+    /// How long to spin before sleeping.
+    int spins;
+
+    // Statistics (only updated by the lock holder).
+    unsigned long acquisitions;
+    unsigned long contentions;
+    unsigned long sleeps;
+  };
+
+  static inline void pause (void) {
+#if defined(__i386__) || defined(__x86_64__)
+    asm volatile ("pause" : : : "memory");
+#endif
+  }
+
+  /// @brief Sleep as long as the lock word is still val.
+  void wait (int val) {
+#if defined(linux)
+    syscall (SYS_futex, &_shared->word, FUTEX_WAIT, val, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+  }
+
+  /// @brief Wake up one sleeper, if any.
+  void wake (void) {
+#if defined(linux)
+    syscall (SYS_futex, &_shared->word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+  }
 
-  /// A pointer to the lock.
-  pthread_mutex_t * _lock;
+  /// The lock word and statistics (shared).
+  sharedState * _shared;
 
-  /// The lock's attributes.
-  pthread_mutexattr_t _attr;
+  /// How many times this process has (recursively) locked the lock.
+  int _depth;
 
 };
 
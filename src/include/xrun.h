@@ -49,6 +49,32 @@
 
 // Grace utilities
 #include "xatomic.h"
+#include "xstaging.h"
+
+// Let the process at the head of the commit order (which can no
+// longer be rolled back) write straight to shared memory, skipping
+// read tracking, private copies and copying at commit.
+#ifndef USE_DIRECT_HEAD
+#define USE_DIRECT_HEAD 1
+#endif
+
+// While no spawned thread is running, let the initial process run
+// with memory entirely unprotected (no faults, no copies, no
+// commits) until it spawns again. (Requires USE_DIRECT_HEAD.)
+#ifndef USE_SERIAL_BYPASS
+#define USE_SERIAL_BYPASS 1
+#endif
+
+// Let a thread that finishes before its predecessor stage its write
+// set and let go of its private pages, rather than wait to commit;
+// whoever reaches its place in the commit order first commits it.
+#ifndef USE_STAGED_COMMIT
+#define USE_STAGED_COMMIT 1
+#endif
+
+#if USE_STAGED_COMMIT && (defined(linux) || defined(__SVR4))
+#include <stdio_ext.h>
+#endif
 
 
 class xrun {
@@ -56,9 +82,11 @@ class xrun {
 private:
 
   xrun (void)
-    : _isInitialized (false),
+    : _memory (xmemory::getInstance()),
+      _isInitialized (false),
       _pred (0),
-      _memory (xmemory::getInstance())
+      _unordered (false),
+      _retryOrdered (false)
   {
   }
 
@@ -78,10 +106,19 @@ public:
 
       // Initialize the context.
       _context.initialize();
+
+      // Let the memory manager roll us back if it finds a conflict
+      // partway through a transaction.
+      _memory.setConflictHandler (conflict);
       
       // Set the current _tid to our process id.
       _thread.setId (getpid());
 
+      // Check only writes for conflicts, everywhere?
+      if (getenv ("GRACE_SNAPSHOT")) {
+	_memory.setSnapshot();
+      }
+
       // Set thread to spawn no more threads than number of processors.
       _thread.setMaxThreads (HL::CPUInfo::getNumProcessors());
       
@@ -135,6 +172,24 @@ public:
     return _thread.spawn (this, fn, arg);
   }
 
+  /// @brief Spawn a thread that may commit out of order with respect
+  /// to its siblings and its parent (until the parent syncs with it).
+  /// @note Its transactions commit as soon as what they read is still
+  /// current, so this is only for threads whose effects commute.
+  inline void * spawnUnordered (threadFunction * fn,
+				void * arg)
+  {
+    return _thread.spawn (this, fn, arg, xthread::UNORDERED);
+  }
+
+  /// @brief Spawn a thread that only checks its writes for conflicts.
+  /// @see xmemory::setSnapshot
+  inline void * spawnSnapshot (threadFunction * fn,
+			       void * arg)
+  {
+    return _thread.spawn (this, fn, arg, xthread::SNAPSHOT);
+  }
+
   /// @brief Wait for a thread.
   inline void sync (void * v, void ** result) {
     _thread.sync (this, v, result);
@@ -208,9 +263,30 @@ public:
 
   /// @brief Start a transaction.
   void atomicBegin (void) {
+#if USE_DIRECT_HEAD && USE_SERIAL_BYPASS
+    if (_memory.isUnprotected()) {
+      // Still alone: nothing can roll us back.
+      return;
+    }
+#endif
+
     // Roll back to here on abort.
     _context.commit();
 
+#if USE_DIRECT_HEAD
+    // With no predecessor, nobody can commit ahead of us, so there
+    // is nothing to speculate about. (This also publishes anything
+    // written since the last commit, which would otherwise be lost
+    // when we switch to the shared mapping.)
+    // (Unordered threads, though -- ours or anyone's -- can commit
+    // ahead of us, and would have to wait for us to finish.)
+    if (!_pred && !isUnordered() && !_thread.unorderedRunning()) {
+      // If nobody else is running at all, nobody can read what we
+      // write either, so we need not even track it.
+      _memory.beginDirect (USE_SERIAL_BYPASS && _thread.isAlone());
+    }
+#endif
+
     // Now start.
     _memory.begin();
   }
@@ -236,6 +312,11 @@ public:
       // will no longer wait for anyone (since it has already waited
       // for its predecessor).
       _pred = 0;
+      _retryOrdered = false;
+      break;
+    case UNORDERED:
+      // We did not wait for our predecessor either, so (as with an
+      // optimized commit) hang on to it.
       break;
     case OPTIMIZED:
       // If the commit was optimized, then we need to maintain the
@@ -246,15 +327,50 @@ public:
     };
   }
 
+  /// @brief Protect memory again at the end of this transaction
+  /// (if it is unprotected), since we are about to spawn a thread.
+  inline void rearm (void) {
+    // Nothing tracked the writes to stdout's buffer, so the commit
+    // would not flush it, and the child would print it again.
+    fflush (stdout);
+    _memory.rearm();
+  }
+
   inline void setPred (int tid) {
     _pred = tid;
   }
 
+  /// @brief Set up a newly-forked thread.
+  inline void startThread (int mode) {
+    _memory.forked();
+    if (mode & xthread::UNORDERED) {
+      _unordered = true;
+    }
+    if (mode & xthread::SNAPSHOT) {
+      _memory.setSnapshot();
+    }
+    _retryOrdered = false;
+  }
+
+  /// @brief End the last transaction of a thread.
+  void atomicExit (void) {
+#if USE_STAGED_COMMIT
+    if (stagedCommit()) {
+      return;
+    }
+#endif
+    atomicEnd();
+  }
+
   inline void waitPred (void) {
     if (!_pred) {
       return;
     }
+#if USE_STAGED_COMMIT
+    commitThrough (_pred);
+#else
     _thread.waitExited (_pred);
+#endif
   }
 
 
@@ -272,15 +388,37 @@ private:
     if (!_memory.isConsistent()) {
       abort();
     }
+
+#if USE_DIRECT_HEAD
+    // We are now irrevocable, so stop speculating.
+    if (!_memory.isDirect() && !_memory.beginDirect()) {
+      abort();
+    }
+#endif
   }
 
 
-  typedef enum { FAILED, SUCCEEDED, OPTIMIZED } commitResult;
+  typedef enum { FAILED, SUCCEEDED, OPTIMIZED, UNORDERED } commitResult;
+
+  /// @return true iff this transaction may commit out of order.
+  inline bool isUnordered (void) const {
+    return _unordered && !_retryOrdered;
+  }
 
 
   /// @brief Check consistency and commit atomically (if consistent).
   inline commitResult atomicCommit (void) {
 
+#if USE_DIRECT_HEAD && USE_SERIAL_BYPASS
+    // We wrote everything straight to shared memory, and nobody else
+    // is running, so we have nothing to check or publish.
+    if (_memory.isUnprotected()) {
+      _xio.commit();
+      fflush (stdout);
+      return SUCCEEDED;
+    }
+#endif
+
     // First, the NULL optimization.  If we haven't read or written
     // anything, we don't have to wait or commit --- just update our
     // view of memory and return that we executed an OPTIMIZED commit.
@@ -290,6 +428,17 @@ private:
       return OPTIMIZED;
     }
 
+    if (isUnordered()) {
+      // Commit now, as long as nothing we read has changed.
+      if (!_memory.tryToCommit()) {
+	// Re-execute, and this time wait our turn.
+	_retryOrdered = true;
+	return FAILED;
+      }
+      _xio.commit();
+      return UNORDERED;
+    }
+
     // Wait for our immediate predecessor to complete.
     waitPred();
 
@@ -298,13 +447,89 @@ private:
     bool committed = _memory.tryToCommit();
     if (committed) {
       _xio.commit();
-      fflush (stdout);
       return SUCCEEDED;
     } else {
       return FAILED;
     }
   }
 
+#if USE_STAGED_COMMIT
+  /// @brief Commit without waiting for our predecessor, by staging
+  /// our write set for whoever commits next.
+  /// @return true iff we committed; false if we did not stage
+  /// anything (and should just commit the usual way).
+  bool stagedCommit (void) {
+    if (!_pred || _thread.hasExited (_pred) || _memory.isNop() || isUnordered()) {
+      return false;
+    }
+
+    // Only a commit in this process can write out our buffered output.
+    if (outputPending()) {
+      return false;
+    }
+
+    // No point in staging a write set that is already stale. (Wait
+    // our turn the usual way, rather than re-executing right away
+    // and likely conflicting again.)
+    if (!_memory.isConsistent()) {
+      return false;
+    }
+
+    int me = _thread.getId();
+    void * buf = _staging.reserve (me, _pred, _memory.stagedSize());
+    if (buf == NULL) {
+      return false;
+    }
+    _memory.stage (buf);
+
+    // Everything we need is staged, so drop our private copies.
+    _memory.updateAll();
+    _staging.publish (me);
+
+    // Wait our turn. A successor may reach it first and commit (or
+    // reject) our write set for us.
+    commitThrough (_pred);
+    if (_staging.claim (me)) {
+      _staging.finish (me, _memory.applyStaged (buf));
+    }
+    if (!_staging.wait (me)) {
+      // Someone committed something we read.
+      abort();
+    }
+
+    _pred = 0;
+    _xio.commit();
+    return true;
+  }
+
+  /// @return true iff stdout has output buffered (or we cannot tell).
+  static bool outputPending (void) {
+#if defined(linux) || defined(__SVR4)
+    return (__fpending (stdout) > 0);
+#else
+    return true;
+#endif
+  }
+
+  /// @brief Wait for a process to commit, committing its staged write
+  /// set (after those of its predecessors) if it has one.
+  void commitThrough (int pid) {
+    if (_staging.claim (pid)) {
+      int pred = _staging.pred (pid);
+      if (pred) {
+	commitThrough (pred);
+      }
+      _staging.finish (pid, _memory.applyStaged (_staging.get (pid)));
+    }
+    _thread.waitExited (pid);
+  }
+#endif
+
+  /// @brief Roll back the current transaction, which conflicts.
+  static void conflict (void) {
+    getInstance().abort();
+  }
+
   /// @brief Abort a transaction in progress.
   void abort (void) {
 #if 0 // ndef NDEBUG
@@ -329,9 +554,21 @@ private:
   /// The I/O manager.
   xio		   _xio;
 
+#if USE_STAGED_COMMIT
+  /// Write sets waiting for their turn to commit.
+  xstaging	   _staging;
+#endif
+
   /// The last transaction we are waiting for.
   int 		   _pred;
 
+  /// True iff we were spawned unordered.
+  bool		   _unordered;
+
+  /// True iff this transaction conflicted when committing out of
+  /// order, and so must wait its turn.
+  bool		   _retryOrdered;
+
 };
 
 
@@ -0,0 +1,198 @@
+// -*- C++ -*-
+
+/*
+  Author: Emery Berger, http://www.cs.umass.edu/~emery
+
+  Copyright (c) 2007-8 Emery Berger, University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef _XSOFTDIRTYTRACKER_H_
+#define _XSOFTDIRTYTRACKER_H_
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "xdefines.h"
+#include "xfaulttracker.h"
+
+/**
+ * @class xsoftdirtytracker
+ * @brief Finds written pages with the kernel's soft-dirty bits.
+ *
+ * Writing 4 to /proc/self/clear_refs clears the soft-dirty bit of
+ * every page in the process; the kernel sets it again (with a minor
+ * fault, but no signal) when a page gets written, and reports it in
+ * /proc/self/pagemap. The bits are per process rather than per range,
+ * so arm() clears them once per transaction, however many regions
+ * ask.
+ *
+ * Needs a kernel built with CONFIG_MEM_SOFT_DIRTY; track() fails
+ * otherwise.
+ *
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ */
+
+class xsoftdirtytracker {
+public:
+
+  typedef xfaulttracker::run run;
+
+  xsoftdirtytracker (void)
+    : _pagemap (-1)
+  {}
+
+  /// @brief Start tracking writes to a (freshly mapped) range.
+  /// @return true iff we can.
+  bool track (void *, size_t) {
+    if (_pagemap == -1) {
+      _pagemap = open ("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+      if (_pagemap == -1) {
+	return false;
+      }
+    }
+    return works();
+  }
+
+  /// @brief Get ready to track (again) in a new child process.
+  void forked (void) {
+    if (_pagemap != -1) {
+      // This is the parent's pagemap.
+      close (_pagemap);
+      _pagemap = -1;
+    }
+    armed() = false;
+  }
+
+  /// @brief Start a transaction: forget what was written so far.
+  void arm (void) {
+    if (!armed()) {
+      clearRefs();
+      armed() = true;
+    }
+  }
+
+  /// @brief End a transaction (so the next arm() really clears).
+  void disarm (void) {
+    armed() = false;
+  }
+
+  /// @brief Arm tracking for pages we are about to make writable.
+  /// @note Nothing to do: arm() already covered every page.
+  void protect (void *, size_t) {}
+
+  /// @brief Find the runs of written pages in [start, end).
+  /// @return the number of runs put in out (at most max).
+  /// @arg next  where to look next (end, once we are done).
+  int written (char * start, char * end, run * out, int max, char ** next) {
+    enum { EntriesPerRead = 512 };
+    uint64_t entries[EntriesPerRead];
+    int n = 0;
+    char * p = start;
+    while ((p < end) && (n < max)) {
+      size_t pages = (end - p) / xdefines::PageSize;
+      if (pages > EntriesPerRead) {
+	pages = EntriesPerRead;
+      }
+      off_t offset = ((size_t) p / xdefines::PageSize) * sizeof(uint64_t);
+      if (pread (_pagemap, entries, pages * sizeof(uint64_t), offset) != (ssize_t) (pages * sizeof(uint64_t))) {
+	// Assume the worst.
+	out[n].start = (size_t) p;
+	out[n].end = (size_t) end;
+	n++;
+	p = end;
+	break;
+      }
+      for (size_t i = 0; i < pages; i++, p += xdefines::PageSize) {
+	if (!isSoftDirty (entries[i])) {
+	  continue;
+	}
+	if ((n > 0) && (out[n-1].end == (size_t) p)) {
+	  // Extend the last run.
+	  out[n-1].end += xdefines::PageSize;
+	} else if (n < max) {
+	  out[n].start = (size_t) p;
+	  out[n].end = (size_t) p + xdefines::PageSize;
+	  n++;
+	} else {
+	  // Out of room: pick up here next time.
+	  *next = p;
+	  return n;
+	}
+      }
+    }
+    *next = p;
+    return n;
+  }
+
+private:
+
+  static inline bool isSoftDirty (uint64_t entry) {
+    return (entry >> 55) & 1;
+  }
+
+  static void clearRefs (void) {
+    int fd = open ("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd != -1) {
+      // (4 clears just the soft-dirty bits.)
+      write (fd, "4", 1);
+      close (fd);
+    }
+  }
+
+  /// @return true iff the kernel keeps soft-dirty bits (checked once).
+  bool works (void) {
+    static int works = -1;
+    if (works == -1) {
+      // Write to a scratch page after clearing, and see if it shows up.
+      char * page = (char *)
+	mmap (NULL, xdefines::PageSize, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      uint64_t entry = 0;
+      if (page != MAP_FAILED) {
+	page[0] = 1;
+	clearRefs();
+	page[0] = 2;
+	off_t offset = ((size_t) page / xdefines::PageSize) * sizeof(uint64_t);
+	if (pread (_pagemap, &entry, sizeof(entry), offset) != sizeof(entry)) {
+	  entry = 0;
+	}
+	munmap (page, xdefines::PageSize);
+      }
+      works = isSoftDirty (entry);
+      armed() = false;
+    }
+    return works;
+  }
+
+  /// @return true iff the soft-dirty bits were cleared for the
+  /// current transaction (shared by every region in this process).
+  static bool& armed (void) {
+    static bool _armed = false;
+    return _armed;
+  }
+
+  /// This process's /proc/self/pagemap (or -1).
+  int _pagemap;
+
+};
+
+#endif
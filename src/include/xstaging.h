@@ -0,0 +1,214 @@
+// -*- C++ -*-
+
+/*
+  Author: Emery Berger, http://www.cs.umass.edu/~emery
+
+  Copyright (c) 2007-8 Emery Berger, University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef _XSTAGING_H_
+#define _XSTAGING_H_
+
+#if !defined(_WIN32)
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#if defined(linux)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xatomic.h"
+#include "xdefines.h"
+#include "xplock.h"
+
+/**
+ * @class xstaging
+ * @brief A shared staging area for the write sets of finished threads.
+ *
+ * A thread that finishes before its logical predecessor stages its
+ * write set (and the versions of everything it read) here, keyed by
+ * its pid. Whoever gets to that point in the commit order first --
+ * the thread itself, or a successor waiting on it -- claims the
+ * staged write set, and applies it or rejects it. The thread then
+ * exits, or re-executes if its write set was rejected.
+ *
+ * Staged write sets are carved out of one large shared arena, which
+ * is reset whenever nothing is staged.
+ *
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ */
+
+class xstaging {
+public:
+
+  /// The states of a staging slot.
+  enum { FREE = 0, STAGED, APPLYING, APPLIED, REJECTED };
+
+  xstaging (void)
+    : _lock ()
+  {
+    _shared = (sharedState *) allocate (sizeof(sharedState));
+    _arena = (char *) allocate (ArenaSize);
+    if ((_shared == MAP_FAILED) || (_arena == MAP_FAILED)) {
+      fprintf (stderr, "Couldn't create the staging area.\n");
+      ::abort();
+    }
+  }
+
+  /// @brief Reserve space to stage a write set.
+  /// @return the space, or NULL if the arena is full.
+  void * reserve (int pid, int pred, size_t sz) {
+    slot& s = getSlot (pid);
+    sz = (sz + xdefines::PageSize - 1) & ~(xdefines::PageSize - 1);
+    _lock.lock();
+    if ((s.state != FREE) || (_shared->top + sz > ArenaSize)) {
+      _lock.unlock();
+      return NULL;
+    }
+    s.pid = pid;
+    s.pred = pred;
+    s.offset = _shared->top;
+    s.size = sz;
+    _shared->top += sz;
+    _shared->outstanding++;
+    _lock.unlock();
+    return &_arena[s.offset];
+  }
+
+  /// @brief Make a reserved write set available to be applied.
+  void publish (int pid) {
+    xatomic::memoryBarrier();
+    getSlot (pid).state = STAGED;
+  }
+
+  /// @return true iff this process has a staged write set.
+  bool isStaged (int pid) {
+    slot& s = getSlot (pid);
+    return (s.pid == pid) && (s.state == STAGED);
+  }
+
+  /// @brief Take over applying this process's staged write set.
+  /// @return true iff we got it.
+  bool claim (int pid) {
+    slot& s = getSlot (pid);
+    return (s.pid == pid)
+      && (xatomic::compare_and_swap (&s.state, STAGED, APPLYING) == STAGED);
+  }
+
+  /// @return the logical predecessor of a (claimed) staged process.
+  int pred (int pid) {
+    return getSlot (pid).pred;
+  }
+
+  /// @return the write set a (claimed) process staged.
+  void * get (int pid) {
+    return &_arena[getSlot (pid).offset];
+  }
+
+  /// @brief Report whether a claimed write set was applied.
+  void finish (int pid, bool applied) {
+    slot& s = getSlot (pid);
+    xatomic::memoryBarrier();
+    s.state = applied ? APPLIED : REJECTED;
+#if defined(linux)
+    syscall (SYS_futex, &s.state, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+  }
+
+  /// @brief Wait for someone to apply (or reject) our write set, and
+  /// give back its space.
+  /// @return true iff it was applied.
+  bool wait (int pid) {
+    slot& s = getSlot (pid);
+    int state;
+    while (((state = s.state) == STAGED) || (state == APPLYING)) {
+#if defined(linux)
+      syscall (SYS_futex, &s.state, FUTEX_WAIT, state, NULL, NULL, 0);
+#else
+      sched_yield();
+#endif
+    }
+    _lock.lock();
+    madvise (&_arena[s.offset], s.size, MADV_REMOVE);
+    s.state = FREE;
+    if (--_shared->outstanding == 0) {
+      // Nothing is staged, so start again from the bottom.
+      _shared->top = 0;
+    }
+    _lock.unlock();
+    return (state == APPLIED);
+  }
+
+private:
+
+  enum { NumSlots = 65536 };
+
+  enum { ArenaSize = 256 * 1048576 };
+
+  struct slot {
+    /// FREE, STAGED, APPLYING, APPLIED, or REJECTED.
+    volatile int state;
+    /// The process that staged this write set.
+    int pid;
+    /// Its logical predecessor.
+    int pred;
+    /// Where it is in the arena.
+    size_t offset;
+    size_t size;
+  };
+
+  struct sharedState {
+    /// The first free byte of the arena.
+    size_t top;
+    /// How many slots are not FREE.
+    int outstanding;
+    slot slots[NumSlots];
+  };
+
+  slot& getSlot (int pid) {
+    return _shared->slots[pid % NumSlots];
+  }
+
+  static void * allocate (size_t sz) {
+    return mmap (NULL,
+		 sz,
+		 PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+		 -1,
+		 0);
+  }
+
+  /// Guards allocation from the arena.
+  xplock _lock;
+
+  /// The slots and arena bookkeeping (shared).
+  sharedState * _shared;
+
+  /// The staged write sets (shared).
+  char * _arena;
+
+};
+
+#endif
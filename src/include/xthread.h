@@ -12,6 +12,7 @@
 
 #include <stdlib.h>
 
+#include "xatomic.h"
 #include "xdefines.h"
 #include "xlatch.h"
 #include "xsemaphore.h"
@@ -57,13 +58,28 @@ private:
 
     /// Whether this thread was created by a fork or not.
     bool forked;
+
+    /// Whether this thread commits in order.
+    bool ordered;
   };
 
 public:
 
+  /// How a spawned thread runs (or'ed together).
+  enum {
+    /// It may commit before its predecessors (see xrun::spawnUnordered).
+    UNORDERED = 1,
+    /// It checks only its writes for conflicts (see xrun::spawnSnapshot).
+    SNAPSHOT = 2
+  };
+
   xthread (void)
     : _nestingLevel (0)
   {
+    _live = (volatile unsigned long *) allocateSharedObject (sizeof(unsigned long));
+    *_live = 0;
+    _unorderedLive = (volatile unsigned long *) allocateSharedObject (sizeof(unsigned long));
+    *_unorderedLive = 0;
 #if USE_XLATCH
     initExited();
 #endif
@@ -77,7 +93,8 @@ public:
 
   void * spawn (xrun * runner,
 		threadFunction * fn,
-		void * arg);
+		void * arg,
+		int mode = 0);
 
   void sync (xrun * runner,
 	     void * v,
@@ -91,6 +108,19 @@ public:
     _tid = id;
   }
 
+  /// @return true iff no spawned thread is still running.
+  /// @note Every spawned process counts itself, so only the initial
+  /// process can ever be alone.
+  inline bool isAlone (void) const {
+    return (xatomic::atomic_read (_live) == 0);
+  }
+
+  /// @return true iff some unordered thread (anyone's) has yet to
+  /// commit its last transaction.
+  inline bool unorderedRunning (void) const {
+    return (xatomic::atomic_read (_unorderedLive) != 0);
+  }
+
 #if USE_XLATCH
 
   /// An array to keep track of whether a thread has exited yet.
@@ -118,11 +148,21 @@ public:
     _threadExitStatus[getId() % THREAD_STATUS_LENGTH].unlatch();
   }
 
+  /// @return true iff the given process has exited.
+  inline bool hasExited (int pid) {
+    return _threadExitStatus[pid % THREAD_STATUS_LENGTH].isUnlatched();
+  }
+
 #else
 
   inline void setExited (void) {
   }
 
+  /// @return true iff the given process has exited.
+  static bool hasExited (int pid) {
+    return (kill (pid, 0) == -1) && (errno == ESRCH);
+  }
+
   /// @brief Wait until a given process has exited.
   static void waitExited (int pid) {
 
@@ -157,7 +197,8 @@ private:
   void * forkSpawn (xrun * runner,
 		    threadFunction * fn,
 		    ThreadStatus * t,
-		    void * arg);
+		    void * arg,
+		    int mode);
 
   static void run_thread (xrun * runner,
 			  threadFunction * fn,
@@ -175,12 +216,68 @@ private:
   /// A heap that just holds pages to hold thread results.
   HL::FreelistHeap<HL::ZoneHeap<HL::MmapHeap, 4096> > _tstatHeap;
 
+  /// @class StatusPagePool
+  /// @brief Keeps the shared pages that hold the results of forked
+  /// threads for reuse, rather than mapping and unmapping one on
+  /// every spawn.
+  /// @note The pool is private to each process (and so not threaded
+  /// through the pages themselves), and a forked child drops its
+  /// copy: only the process that freed a page ever reuses it.
+  class StatusPagePool {
+  public:
+    enum { PageSize = 4096 };
+
+    StatusPagePool (void)
+      : _count (0)
+    {}
+
+    void * get (void) {
+      if (_count > 0) {
+	return _pages[--_count];
+      }
+      return mmap (NULL,
+		   PageSize,
+		   PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS,
+		   -1,
+		   0);
+    }
+
+    void put (void * ptr) {
+      if (_count < MaxPages) {
+	_pages[_count++] = ptr;
+      } else {
+	munmap (ptr, PageSize);
+      }
+    }
+
+    /// @brief Forget every page in the pool (without unmapping them).
+    void forget (void) {
+      _count = 0;
+    }
+
+  private:
+    enum { MaxPages = 64 };
+    int _count;
+    void * _pages[MaxPages];
+  };
+
+  /// Shared pages to hold the results of forked threads.
+  StatusPagePool _statusPages;
+
   /// Current nesting level (i.e., how deep we are in recursive threads).
   unsigned int	   _nestingLevel;
 
   /// What is this thread's PID?
   int              _tid;
 
+  /// How many spawned processes are running (shared by all of them).
+  volatile unsigned long * _live;
+
+  /// How many of them are unordered and still running their thread
+  /// function (shared by all of them).
+  volatile unsigned long * _unorderedLive;
+
   /// @return a chunk of memory shared across processes.
   void * allocateSharedObject (size_t sz) {
     return mmap (NULL,
@@ -0,0 +1,193 @@
+// -*- C++ -*-
+
+/*
+  Author: Emery Berger, http://www.cs.umass.edu/~emery
+
+  Copyright (c) 2007-8 Emery Berger, University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef _XUFFDTRACKER_H_
+#define _XUFFDTRACKER_H_
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <linux/userfaultfd.h>
+
+#include "xfaulttracker.h"
+
+// Older headers lack asynchronous write protection (Linux 6.7) and
+// the pagemap scan that goes with it.
+
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+#ifndef PAGEMAP_SCAN
+struct pm_scan_arg {
+  __u64 size;
+  __u64 flags;
+  __u64 start;
+  __u64 end;
+  __u64 walk_end;
+  __u64 vec;
+  __u64 vec_len;
+  __u64 max_pages;
+  __u64 category_inverted;
+  __u64 category_mask;
+  __u64 category_anyof_mask;
+  __u64 return_mask;
+};
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+#define PAGE_IS_WRITTEN (1 << 1)
+#endif
+
+/**
+ * @class xuffdtracker
+ * @brief Finds written pages with userfaultfd write protection.
+ *
+ * Pages are write-protected with userfaultfd in asynchronous mode,
+ * so the kernel itself lifts the protection on the first write to a
+ * page (no signal, no userspace round trip). Afterwards, a
+ * PAGEMAP_SCAN of /proc/self/pagemap reports which pages lost their
+ * protection -- i.e., which were written.
+ *
+ * Needs Linux 6.7 or later, permission to use userfaultfd, and
+ * memory-backed (shmem) mappings; track() fails otherwise.
+ *
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ */
+
+class xuffdtracker {
+public:
+
+  typedef xfaulttracker::run run;
+
+  xuffdtracker (void)
+    : _uffd (-1),
+      _pagemap (-1)
+  {}
+
+  /// @brief Start tracking writes to a (freshly mapped) range.
+  /// @return true iff we can.
+  bool track (void * start, size_t len) {
+    if ((_uffd == -1) && !open()) {
+      return false;
+    }
+    struct uffdio_register reg;
+    reg.range.start = (unsigned long) start;
+    reg.range.len = len;
+    reg.mode = UFFDIO_REGISTER_MODE_WP;
+    return (ioctl (_uffd, UFFDIO_REGISTER, &reg) == 0);
+  }
+
+  /// @brief Get ready to track (again) in a new child process.
+  /// @note A child does not inherit registrations, and what we had
+  /// open refers to the parent.
+  void forked (void) {
+    if (_uffd != -1) {
+      close (_uffd);
+      close (_pagemap);
+      _uffd = -1;
+      _pagemap = -1;
+    }
+  }
+
+  /// @brief Start a transaction.
+  void arm (void) {}
+
+  /// @brief End a transaction.
+  void disarm (void) {}
+
+  /// @brief Arm tracking for pages we are about to make writable.
+  void protect (void * start, size_t len) {
+    struct uffdio_writeprotect wp;
+    wp.range.start = (unsigned long) start;
+    wp.range.len = len;
+    wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+    ioctl (_uffd, UFFDIO_WRITEPROTECT, &wp);
+  }
+
+  /// @brief Find the runs of written pages in [start, end).
+  /// @return the number of runs put in out (at most max).
+  /// @arg next  where to look next (end, once we are done).
+  /// @note Pages that were never protected count as written.
+  int written (char * start, char * end, run * out, int max, char ** next) {
+    struct pm_scan_arg arg;
+    memset (&arg, 0, sizeof(arg));
+    arg.size = sizeof(arg);
+    arg.flags = PM_SCAN_CHECK_WPASYNC;
+    arg.start = (unsigned long) start;
+    arg.end = (unsigned long) end;
+    arg.vec = (unsigned long) out;
+    arg.vec_len = max;
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask = PAGE_IS_WRITTEN;
+    int n = ioctl (_pagemap, PAGEMAP_SCAN, &arg);
+    if (n < 0) {
+      // Assume the worst.
+      out[0].start = arg.start;
+      out[0].end = arg.end;
+      *next = end;
+      return 1;
+    }
+    *next = (char *) arg.walk_end;
+    return n;
+  }
+
+private:
+
+  /// @brief Open a userfaultfd with asynchronous write protection,
+  /// and the pagemap.
+  bool open (void) {
+    _uffd = syscall (SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (_uffd == -1) {
+      return false;
+    }
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_WP_ASYNC;
+    api.ioctls = 0;
+    _pagemap = ::open ("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if ((ioctl (_uffd, UFFDIO_API, &api) != 0) || (_pagemap == -1)) {
+      close (_uffd);
+      if (_pagemap != -1) {
+	close (_pagemap);
+      }
+      _uffd = -1;
+      _pagemap = -1;
+      return false;
+    }
+    return true;
+  }
+
+  /// The userfaultfd (or -1).
+  int _uffd;
+
+  /// This process's /proc/self/pagemap (or -1).
+  int _pagemap;
+
+};
+
+#endif
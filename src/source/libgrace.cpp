@@ -27,6 +27,7 @@
 
 #include <stdarg.h>
 #include "xrun.h"
+#include "xpagekernels.h"
 
 #define REPLACE_HEAP_FUNCTIONS 1
 #define REPLACE_IO_FUNCTIONS 1
@@ -111,6 +112,16 @@ extern "C" {
     return xrun::getInstance().spawn (fn, arg);
   }
 
+  void * gracespawn_unordered (void *(*fn) (void *), void * arg)
+  {
+    return xrun::getInstance().spawnUnordered (fn, arg);
+  }
+
+  void * gracespawn_snapshot (void *(*fn) (void *), void * arg)
+  {
+    return xrun::getInstance().spawnSnapshot (fn, arg);
+  }
+
   void gracesync (void * v, void ** val) {
     return xrun::getInstance().sync (v, val);
   }
@@ -274,9 +285,24 @@ extern "C" {
   }
 
   void * calloc (size_t n, size_t s) {
-    void * ptr = gracemalloc (n * s);
+    size_t sz = n * s;
+    char * ptr = (char *) gracemalloc (sz);
     if (ptr) {
-      memset (ptr, 0, n * s);
+      // Only clear whole pages that are not already zero: writing
+      // them would needlessly add them to this transaction's write set.
+      char * start = (char *) (((size_t) ptr + xdefines::PageSize - 1) & ~(xdefines::PageSize - 1));
+      char * end   = (char *) (((size_t) ptr + sz) & ~(xdefines::PageSize - 1));
+      if (start >= end) {
+	memset (ptr, 0, sz);
+      } else {
+	memset (ptr, 0, start - ptr);
+	for (char * page = start; page < end; page += xdefines::PageSize) {
+	  if (!xpagekernels::isZero (page)) {
+	    memset (page, 0, xdefines::PageSize);
+	  }
+	}
+	memset (end, 0, ptr + sz - end);
+      }
     }
     return ptr;
   }
@@ -407,6 +433,9 @@ extern "C"
     va_start (ap, format);
     int v = vprintf (format, ap);
     va_end (ap);
+    // Write it out now, between transactions: otherwise, nothing
+    // would track the buffer we just wrote.
+    fflush (stdout);
     xrun::getInstance().atomicBegin();
     return v;
   }
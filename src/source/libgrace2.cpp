@@ -197,6 +197,16 @@ extern "C" {
     return theRunner->spawn (fn, arg);
   }
 
+  void * gracespawn_unordered (void *(*fn) (void *), void * arg)
+  {
+    return theRunner->spawnUnordered (fn, arg);
+  }
+
+  void * gracespawn_snapshot (void *(*fn) (void *), void * arg)
+  {
+    return theRunner->spawnSnapshot (fn, arg);
+  }
+
   void gracesync (void * v, void ** val) {
 #if 0
     if (!isInitialized) {
@@ -0,0 +1,146 @@
+// Benchmark (and sanity check) for the page kernels at every level
+// this processor supports.
+//
+// Build with "make pagebench"; run as "./pagebench [iterations]".
+
+#include <iostream>
+using namespace std;
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "xdefines.h"
+#include "xpagekernels.h"
+
+/////////////////////////////////
+
+enum { RANGE = xdefines::PageSize };
+
+static const int pageCounts[] = { 1, 16, 256, 4096 };
+
+static double now (void) {
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static char * allocate (int pages) {
+  return (char *) mmap (0, RANGE * pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+}
+
+// Fill local (and twin) so every page has a few scattered diffs.
+static void setup (char * local, char * twin, char * dest, int pages) {
+  memset (twin, ' ', RANGE * pages);
+  memset (local, ' ', RANGE * pages);
+  memset (dest, '_', RANGE * pages);
+  for (int i = 0; i < pages; i++) {
+    local[i * RANGE + 4] = 'Z';
+    local[i * RANGE + RANGE / 2] = 'M';
+    local[i * RANGE + RANGE - 1] = 'Q';
+  }
+}
+
+// Check the selected level against the generic kernels.
+static bool check (char * local, char * twin, char * dest, char * zero) {
+  static char expected[RANGE] __attribute__((aligned(64)));
+  static char mask[RANGE] __attribute__((aligned(64)));
+  static char expectedCopy[RANGE] __attribute__((aligned(64)));
+  static char copy[RANGE] __attribute__((aligned(64)));
+  xpagekernels::level l = xpagekernels::selected();
+
+  // A mask with scattered (and differently non-zero) bytes.
+  for (int i = 0; i < RANGE; i++) {
+    mask[i] = ((i % 7 == 0) || (i % 64 == 63)) ? (char) (i | 1) : 0;
+  }
+
+  memset (dest, '_', RANGE);
+  xpagekernels::select (xpagekernels::GENERIC);
+  memcpy (expected, dest, RANGE);
+  xpagekernels::writeDiffs (local, twin, expected);
+  bool conflict = xpagekernels::conflicts (local, twin, dest);
+  memcpy (expectedCopy, dest, RANGE);
+  xpagekernels::maskedCopy (local, mask, expectedCopy);
+  xpagekernels::select (l);
+
+  bool sameConflict = (xpagekernels::conflicts (local, twin, dest) == conflict);
+  memcpy (copy, dest, RANGE);
+  xpagekernels::maskedCopy (local, mask, copy);
+  xpagekernels::writeDiffs (local, twin, dest);
+  return (memcmp (expected, dest, RANGE) == 0)
+    && (memcmp (expectedCopy, copy, RANGE) == 0)
+    && sameConflict
+    && !xpagekernels::equal (local, twin)
+    && xpagekernels::equal (twin, twin)
+    && !xpagekernels::isZero (local)
+    && xpagekernels::isZero (zero)
+    && (xpagekernels::differingInts ((const int *) local, (const int *) twin) == 0x00000002U)
+    && (xpagekernels::differingInts ((const int *) twin, (const int *) twin) == 0);
+}
+
+int main (int argc, char * argv[])
+{
+  long bytes = (argc > 1) ? atol (argv[1]) : 1L << 30;
+  int maxPages = pageCounts[sizeof(pageCounts)/sizeof(pageCounts[0]) - 1];
+
+  char * local = allocate (maxPages);
+  char * twin  = allocate (maxPages);
+  char * dest  = allocate (maxPages);
+  char * zero  = allocate (maxPages);
+
+  cout << "best level: " << xpagekernels::name (xpagekernels::best()) << endl;
+  cout << "level\tpages\twriteDiffs\tconflicts\tequal\tisZero\tmaskedCopy (GB/s)" << endl;
+
+  for (int l = xpagekernels::GENERIC; l < xpagekernels::NUM_LEVELS; l++) {
+    if (!xpagekernels::supported ((xpagekernels::level) l)) {
+      continue;
+    }
+    xpagekernels::select ((xpagekernels::level) l);
+
+    for (unsigned int p = 0; p < sizeof(pageCounts)/sizeof(pageCounts[0]); p++) {
+      int pages = pageCounts[p];
+      long iterations = bytes / ((long) pages * RANGE) + 1;
+      double gb = (double) iterations * pages * RANGE / 1e9;
+      double rates[5];
+      // (Read back below, so the compiler cannot drop the checks.)
+      volatile long hits = 0;
+
+      setup (local, twin, dest, pages);
+      if (!check (local, twin, dest, zero)) {
+	cout << xpagekernels::name ((xpagekernels::level) l) << ": MISMATCH" << endl;
+	return 1;
+      }
+
+      for (int k = 0; k < 5; k++) {
+	double start = now();
+	for (long i = 0; i < iterations; i++) {
+	  for (int j = 0; j < pages; j++) {
+	    char * lp = &local[j * RANGE];
+	    char * tp = &twin[j * RANGE];
+	    char * dp = &dest[j * RANGE];
+	    switch (k) {
+	    case 0: xpagekernels::writeDiffs (lp, tp, dp); break;
+	    case 1: hits += !xpagekernels::conflicts (lp, tp, tp); break;
+	    case 2: hits += xpagekernels::equal (tp, tp); break;
+	    case 3: hits += xpagekernels::isZero (&zero[j * RANGE]); break;
+	    case 4: xpagekernels::maskedCopy (lp, tp, dp); break;
+	    }
+	  }
+	}
+	rates[k] = gb / (now() - start);
+      }
+      if (hits != 3 * iterations * pages) {
+	cout << xpagekernels::name ((xpagekernels::level) l) << ": MISMATCH" << endl;
+	return 1;
+      }
+
+      cout << xpagekernels::name ((xpagekernels::level) l) << "\t" << pages;
+      for (int k = 0; k < 5; k++) {
+	cout << "\t" << rates[k];
+      }
+      cout << endl;
+    }
+  }
+  return 0;
+}
@@ -1,6 +1,8 @@
 #include "xcontext.h"
 #include <stdlib.h>
 
+volatile bool xcontext::_restoring = false;
+
 NO_INLINE void xcontext::commit (void) {
   getContext();
 }
@@ -64,6 +66,11 @@ NO_INLINE void xcontext::getContext (void) {
   volatile unsigned long tos;
   // First, save registers (context).
   if (!getcontext(&_registers)) {
+    if (_restoring) {
+      // We just got here from restoreStack(): nothing to save.
+      _restoring = false;
+      return;
+    }
     // Now, save the stack.
     save_stack (_pbos, (unsigned long *) &tos);
   }
@@ -85,5 +92,6 @@ NO_INLINE void xcontext::restoreStack (int once_more) {
   for (int i = 0; i < _stackSize; ++i) {
     _pbos[-i] = _stack[i];
   }
+  _restoring = true;
   setcontext (&_registers);
 }
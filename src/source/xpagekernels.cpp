@@ -0,0 +1,616 @@
+// -*- C++ -*-
+
+/*
+  Author: Emery Berger, http://www.cs.umass.edu/~emery
+
+  Copyright (c) 2007-8 Emery Berger, University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xpagekernels.cpp
+ * @brief  Page kernels for each instruction set level, and the dispatcher.
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ */
+
+#include <stddef.h>
+
+#include "xdefines.h"
+#include "xpagekernels.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define X86_KERNELS 0
+#endif
+
+// AVX-512 byte operations need a reasonably modern compiler.
+#if X86_KERNELS && ((__GNUC__ >= 5) || defined(__clang__))
+#define AVX512_KERNELS 1
+#else
+#define AVX512_KERNELS 0
+#endif
+
+enum { PAGE_WORDS = xdefines::PageSize / sizeof(size_t) };
+
+
+//
+// Generic kernels: word-at-a-time wherever possible.
+//
+
+static void genericWriteDiffs (const void * local,
+			       const void * twin,
+			       void * dest)
+{
+  const size_t * l = (const size_t *) local;
+  const size_t * t = (const size_t *) twin;
+  size_t * d = (size_t *) dest;
+  for (int i = 0; i < PAGE_WORDS; i++) {
+    if (l[i] != t[i]) {
+      // Only some of the bytes in this word may have changed.
+      const char * lb = (const char *) &l[i];
+      const char * tb = (const char *) &t[i];
+      char * db = (char *) &d[i];
+      for (unsigned int j = 0; j < sizeof(size_t); j++) {
+	if (lb[j] != tb[j]) {
+	  db[j] = lb[j];
+	}
+      }
+    }
+  }
+}
+
+static bool genericConflicts (const void * local,
+			      const void * twin,
+			      const void * committed)
+{
+  const size_t * l = (const size_t *) local;
+  const size_t * t = (const size_t *) twin;
+  const size_t * c = (const size_t *) committed;
+  for (int i = 0; i < PAGE_WORDS; i++) {
+    if ((l[i] != t[i]) && (c[i] != t[i])) {
+      // Both changed this word; see if they changed the same byte.
+      const char * lb = (const char *) &l[i];
+      const char * tb = (const char *) &t[i];
+      const char * cb = (const char *) &c[i];
+      for (unsigned int j = 0; j < sizeof(size_t); j++) {
+	if ((lb[j] != tb[j]) && (cb[j] != tb[j])) {
+	  return true;
+	}
+      }
+    }
+  }
+  return false;
+}
+
+static bool genericEqual (const void * a,
+			  const void * b)
+{
+  const size_t * x = (const size_t *) a;
+  const size_t * y = (const size_t *) b;
+  for (int i = 0; i < PAGE_WORDS; i++) {
+    if (x[i] != y[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool genericIsZero (const void * page)
+{
+  const size_t * p = (const size_t *) page;
+  for (int i = 0; i < PAGE_WORDS; i++) {
+    if (p[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void genericMaskedCopy (const void * src,
+			       const void * mask,
+			       void * dest)
+{
+  const char * s = (const char *) src;
+  const char * m = (const char *) mask;
+  char * d = (char *) dest;
+  for (unsigned int i = 0; i < xdefines::PageSize; i++) {
+    if (m[i]) {
+      d[i] = s[i];
+    }
+  }
+}
+
+static unsigned int genericDifferingInts (const int * a,
+					  const int * b)
+{
+  unsigned int mask = 0;
+  for (int i = 0; i < 32; i++) {
+    mask |= (unsigned int) (a[i] != b[i]) << i;
+  }
+  return mask;
+}
+
+
+#if X86_KERNELS
+
+//
+// SSE2 kernels: 16 bytes at a time.
+//
+
+#define SSE2_TARGET __attribute__ ((target ("sse2")))
+
+enum { SSE2_CHUNKS = xdefines::PageSize / sizeof(__m128i) };
+
+SSE2_TARGET static void sse2WriteDiffs (const void * local,
+					const void * twin,
+					void * dest)
+{
+  const __m128i * l = (const __m128i *) local;
+  const __m128i * t = (const __m128i *) twin;
+  __m128i * d = (__m128i *) dest;
+  for (int i = 0; i < SSE2_CHUNKS; i++) {
+    __m128i lc = _mm_load_si128 (&l[i]);
+    __m128i eq = _mm_cmpeq_epi8 (lc, _mm_load_si128 (&t[i]));
+    if (_mm_movemask_epi8 (eq) != 0xFFFF) {
+      // Keep dest where local matches the twin, and take local elsewhere.
+      __m128i dc = _mm_load_si128 (&d[i]);
+      _mm_store_si128 (&d[i], _mm_or_si128 (_mm_and_si128 (eq, dc),
+					    _mm_andnot_si128 (eq, lc)));
+    }
+  }
+}
+
+SSE2_TARGET static bool sse2Conflicts (const void * local,
+				       const void * twin,
+				       const void * committed)
+{
+  const __m128i * l = (const __m128i *) local;
+  const __m128i * t = (const __m128i *) twin;
+  const __m128i * c = (const __m128i *) committed;
+  for (int i = 0; i < SSE2_CHUNKS; i++) {
+    __m128i tc = _mm_load_si128 (&t[i]);
+    __m128i localSame = _mm_cmpeq_epi8 (_mm_load_si128 (&l[i]), tc);
+    __m128i commitSame = _mm_cmpeq_epi8 (_mm_load_si128 (&c[i]), tc);
+    // Some byte was left alone by neither side?
+    if (_mm_movemask_epi8 (_mm_or_si128 (localSame, commitSame)) != 0xFFFF) {
+      return true;
+    }
+  }
+  return false;
+}
+
+SSE2_TARGET static bool sse2Equal (const void * a,
+				   const void * b)
+{
+  const __m128i * x = (const __m128i *) a;
+  const __m128i * y = (const __m128i *) b;
+  for (int i = 0; i < SSE2_CHUNKS; i += 4) {
+    __m128i eq = _mm_and_si128
+      (_mm_and_si128 (_mm_cmpeq_epi8 (_mm_load_si128 (&x[i]),   _mm_load_si128 (&y[i])),
+		      _mm_cmpeq_epi8 (_mm_load_si128 (&x[i+1]), _mm_load_si128 (&y[i+1]))),
+       _mm_and_si128 (_mm_cmpeq_epi8 (_mm_load_si128 (&x[i+2]), _mm_load_si128 (&y[i+2])),
+		      _mm_cmpeq_epi8 (_mm_load_si128 (&x[i+3]), _mm_load_si128 (&y[i+3]))));
+    if (_mm_movemask_epi8 (eq) != 0xFFFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+SSE2_TARGET static bool sse2IsZero (const void * page)
+{
+  const __m128i * p = (const __m128i *) page;
+  for (int i = 0; i < SSE2_CHUNKS; i += 4) {
+    __m128i any = _mm_or_si128 (_mm_or_si128 (_mm_load_si128 (&p[i]),   _mm_load_si128 (&p[i+1])),
+				_mm_or_si128 (_mm_load_si128 (&p[i+2]), _mm_load_si128 (&p[i+3])));
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (any, _mm_setzero_si128())) != 0xFFFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+SSE2_TARGET static void sse2MaskedCopy (const void * src,
+					const void * mask,
+					void * dest)
+{
+  const __m128i * s = (const __m128i *) src;
+  const __m128i * m = (const __m128i *) mask;
+  __m128i * d = (__m128i *) dest;
+  for (int i = 0; i < SSE2_CHUNKS; i++) {
+    // Bytes to keep are the ones whose mask is zero.
+    __m128i keep = _mm_cmpeq_epi8 (_mm_load_si128 (&m[i]), _mm_setzero_si128());
+    if (_mm_movemask_epi8 (keep) != 0xFFFF) {
+      __m128i dc = _mm_load_si128 (&d[i]);
+      _mm_store_si128 (&d[i], _mm_or_si128 (_mm_and_si128 (keep, dc),
+					    _mm_andnot_si128 (keep, _mm_load_si128 (&s[i]))));
+    }
+  }
+}
+
+SSE2_TARGET static unsigned int sse2DifferingInts (const int * a,
+						   const int * b)
+{
+  unsigned int same = 0;
+  for (int i = 0; i < 32; i += 4) {
+    __m128i eq = _mm_cmpeq_epi32 (_mm_loadu_si128 ((const __m128i *) &a[i]),
+				  _mm_loadu_si128 ((const __m128i *) &b[i]));
+    same |= (unsigned int) _mm_movemask_ps (_mm_castsi128_ps (eq)) << i;
+  }
+  return ~same;
+}
+
+
+//
+// AVX2 kernels: 32 bytes at a time.
+//
+
+#define AVX2_TARGET __attribute__ ((target ("avx2")))
+
+enum { AVX2_CHUNKS = xdefines::PageSize / sizeof(__m256i) };
+
+AVX2_TARGET static void avx2WriteDiffs (const void * local,
+					const void * twin,
+					void * dest)
+{
+  const __m256i * l = (const __m256i *) local;
+  const __m256i * t = (const __m256i *) twin;
+  __m256i * d = (__m256i *) dest;
+  for (int i = 0; i < AVX2_CHUNKS; i++) {
+    __m256i lc = _mm256_load_si256 (&l[i]);
+    __m256i eq = _mm256_cmpeq_epi8 (lc, _mm256_load_si256 (&t[i]));
+    if (_mm256_movemask_epi8 (eq) != -1) {
+      _mm256_store_si256 (&d[i], _mm256_blendv_epi8 (lc, _mm256_load_si256 (&d[i]), eq));
+    }
+  }
+}
+
+AVX2_TARGET static bool avx2Conflicts (const void * local,
+				       const void * twin,
+				       const void * committed)
+{
+  const __m256i * l = (const __m256i *) local;
+  const __m256i * t = (const __m256i *) twin;
+  const __m256i * c = (const __m256i *) committed;
+  for (int i = 0; i < AVX2_CHUNKS; i++) {
+    __m256i tc = _mm256_load_si256 (&t[i]);
+    __m256i localSame = _mm256_cmpeq_epi8 (_mm256_load_si256 (&l[i]), tc);
+    __m256i commitSame = _mm256_cmpeq_epi8 (_mm256_load_si256 (&c[i]), tc);
+    if (_mm256_movemask_epi8 (_mm256_or_si256 (localSame, commitSame)) != -1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+AVX2_TARGET static bool avx2Equal (const void * a,
+				   const void * b)
+{
+  const __m256i * x = (const __m256i *) a;
+  const __m256i * y = (const __m256i *) b;
+  for (int i = 0; i < AVX2_CHUNKS; i += 4) {
+    __m256i diff = _mm256_or_si256
+      (_mm256_or_si256 (_mm256_xor_si256 (_mm256_load_si256 (&x[i]),   _mm256_load_si256 (&y[i])),
+			_mm256_xor_si256 (_mm256_load_si256 (&x[i+1]), _mm256_load_si256 (&y[i+1]))),
+       _mm256_or_si256 (_mm256_xor_si256 (_mm256_load_si256 (&x[i+2]), _mm256_load_si256 (&y[i+2])),
+			_mm256_xor_si256 (_mm256_load_si256 (&x[i+3]), _mm256_load_si256 (&y[i+3]))));
+    if (!_mm256_testz_si256 (diff, diff)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AVX2_TARGET static bool avx2IsZero (const void * page)
+{
+  const __m256i * p = (const __m256i *) page;
+  for (int i = 0; i < AVX2_CHUNKS; i += 4) {
+    __m256i any = _mm256_or_si256 (_mm256_or_si256 (_mm256_load_si256 (&p[i]),   _mm256_load_si256 (&p[i+1])),
+				   _mm256_or_si256 (_mm256_load_si256 (&p[i+2]), _mm256_load_si256 (&p[i+3])));
+    if (!_mm256_testz_si256 (any, any)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AVX2_TARGET static void avx2MaskedCopy (const void * src,
+					const void * mask,
+					void * dest)
+{
+  const __m256i * s = (const __m256i *) src;
+  const __m256i * m = (const __m256i *) mask;
+  __m256i * d = (__m256i *) dest;
+  for (int i = 0; i < AVX2_CHUNKS; i++) {
+    __m256i keep = _mm256_cmpeq_epi8 (_mm256_load_si256 (&m[i]), _mm256_setzero_si256());
+    if (_mm256_movemask_epi8 (keep) != -1) {
+      _mm256_store_si256 (&d[i], _mm256_blendv_epi8 (_mm256_load_si256 (&s[i]),
+						     _mm256_load_si256 (&d[i]),
+						     keep));
+    }
+  }
+}
+
+AVX2_TARGET static unsigned int avx2DifferingInts (const int * a,
+						   const int * b)
+{
+  unsigned int same = 0;
+  for (int i = 0; i < 32; i += 8) {
+    __m256i eq = _mm256_cmpeq_epi32 (_mm256_loadu_si256 ((const __m256i *) &a[i]),
+				     _mm256_loadu_si256 ((const __m256i *) &b[i]));
+    same |= (unsigned int) _mm256_movemask_ps (_mm256_castsi256_ps (eq)) << i;
+  }
+  return ~same;
+}
+
+#endif // X86_KERNELS
+
+
+#if AVX512_KERNELS
+
+//
+// AVX-512 kernels: 64 bytes at a time, using byte-masked stores.
+//
+
+#define AVX512_TARGET __attribute__ ((target ("avx512f,avx512bw")))
+
+enum { AVX512_CHUNKS = xdefines::PageSize / sizeof(__m512i) };
+
+AVX512_TARGET static void avx512WriteDiffs (const void * local,
+					    const void * twin,
+					    void * dest)
+{
+  const __m512i * l = (const __m512i *) local;
+  const __m512i * t = (const __m512i *) twin;
+  __m512i * d = (__m512i *) dest;
+  for (int i = 0; i < AVX512_CHUNKS; i++) {
+    __m512i lc = _mm512_load_si512 (&l[i]);
+    __mmask64 changed = _mm512_cmpneq_epi8_mask (lc, _mm512_load_si512 (&t[i]));
+    if (changed) {
+      _mm512_mask_storeu_epi8 (&d[i], changed, lc);
+    }
+  }
+}
+
+AVX512_TARGET static bool avx512Conflicts (const void * local,
+					   const void * twin,
+					   const void * committed)
+{
+  const __m512i * l = (const __m512i *) local;
+  const __m512i * t = (const __m512i *) twin;
+  const __m512i * c = (const __m512i *) committed;
+  for (int i = 0; i < AVX512_CHUNKS; i++) {
+    __m512i tc = _mm512_load_si512 (&t[i]);
+    __mmask64 mine = _mm512_cmpneq_epi8_mask (_mm512_load_si512 (&l[i]), tc);
+    __mmask64 theirs = _mm512_cmpneq_epi8_mask (_mm512_load_si512 (&c[i]), tc);
+    if (mine & theirs) {
+      return true;
+    }
+  }
+  return false;
+}
+
+AVX512_TARGET static bool avx512Equal (const void * a,
+				       const void * b)
+{
+  const __m512i * x = (const __m512i *) a;
+  const __m512i * y = (const __m512i *) b;
+  for (int i = 0; i < AVX512_CHUNKS; i += 4) {
+    __m512i diff = _mm512_or_si512
+      (_mm512_or_si512 (_mm512_xor_si512 (_mm512_load_si512 (&x[i]),   _mm512_load_si512 (&y[i])),
+			_mm512_xor_si512 (_mm512_load_si512 (&x[i+1]), _mm512_load_si512 (&y[i+1]))),
+       _mm512_or_si512 (_mm512_xor_si512 (_mm512_load_si512 (&x[i+2]), _mm512_load_si512 (&y[i+2])),
+			_mm512_xor_si512 (_mm512_load_si512 (&x[i+3]), _mm512_load_si512 (&y[i+3]))));
+    if (_mm512_test_epi64_mask (diff, diff)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AVX512_TARGET static bool avx512IsZero (const void * page)
+{
+  const __m512i * p = (const __m512i *) page;
+  for (int i = 0; i < AVX512_CHUNKS; i += 4) {
+    __m512i any = _mm512_or_si512 (_mm512_or_si512 (_mm512_load_si512 (&p[i]),   _mm512_load_si512 (&p[i+1])),
+				   _mm512_or_si512 (_mm512_load_si512 (&p[i+2]), _mm512_load_si512 (&p[i+3])));
+    if (_mm512_test_epi64_mask (any, any)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AVX512_TARGET static void avx512MaskedCopy (const void * src,
+					    const void * mask,
+					    void * dest)
+{
+  const __m512i * s = (const __m512i *) src;
+  const __m512i * m = (const __m512i *) mask;
+  __m512i * d = (__m512i *) dest;
+  for (int i = 0; i < AVX512_CHUNKS; i++) {
+    __m512i mc = _mm512_load_si512 (&m[i]);
+    __mmask64 copy = _mm512_test_epi8_mask (mc, mc);
+    if (copy) {
+      _mm512_mask_storeu_epi8 (&d[i], copy, _mm512_load_si512 (&s[i]));
+    }
+  }
+}
+
+AVX512_TARGET static unsigned int avx512DifferingInts (const int * a,
+						       const int * b)
+{
+  __mmask16 lo = _mm512_cmpneq_epi32_mask (_mm512_loadu_si512 (&a[0]),  _mm512_loadu_si512 (&b[0]));
+  __mmask16 hi = _mm512_cmpneq_epi32_mask (_mm512_loadu_si512 (&a[16]), _mm512_loadu_si512 (&b[16]));
+  return (unsigned int) lo | ((unsigned int) hi << 16);
+}
+
+#endif // AVX512_KERNELS
+
+
+//
+// The dispatcher.
+//
+
+xpagekernels::writeDiffsFunction xpagekernels::_writeDiffs = xpagekernels::firstWriteDiffs;
+xpagekernels::conflictsFunction  xpagekernels::_conflicts  = xpagekernels::firstConflicts;
+xpagekernels::equalFunction      xpagekernels::_equal      = xpagekernels::firstEqual;
+xpagekernels::isZeroFunction     xpagekernels::_isZero     = xpagekernels::firstIsZero;
+xpagekernels::maskedCopyFunction xpagekernels::_maskedCopy = xpagekernels::firstMaskedCopy;
+xpagekernels::differingIntsFunction xpagekernels::_differingInts = xpagekernels::firstDifferingInts;
+
+// NUM_LEVELS means that nothing has been selected yet.
+xpagekernels::level xpagekernels::_selected = xpagekernels::NUM_LEVELS;
+
+
+bool xpagekernels::supported (level l)
+{
+#if X86_KERNELS
+  // We may get here from a constructor, before libgcc has looked at cpuid.
+  __builtin_cpu_init();
+#endif
+  switch (l) {
+  case GENERIC:
+    return true;
+#if X86_KERNELS
+  case SSE2:
+    return __builtin_cpu_supports ("sse2");
+  case AVX2:
+    return __builtin_cpu_supports ("avx2");
+#endif
+#if AVX512_KERNELS
+  case AVX512:
+    return __builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw");
+#endif
+  default:
+    return false;
+  }
+}
+
+
+xpagekernels::level xpagekernels::best (void)
+{
+  for (int l = NUM_LEVELS - 1; l > GENERIC; l--) {
+    if (supported ((level) l)) {
+      return (level) l;
+    }
+  }
+  return GENERIC;
+}
+
+
+void xpagekernels::select (level l)
+{
+  switch (l) {
+#if X86_KERNELS
+  case SSE2:
+    _writeDiffs = sse2WriteDiffs;
+    _conflicts  = sse2Conflicts;
+    _equal      = sse2Equal;
+    _isZero     = sse2IsZero;
+    _maskedCopy = sse2MaskedCopy;
+    _differingInts = sse2DifferingInts;
+    break;
+  case AVX2:
+    _writeDiffs = avx2WriteDiffs;
+    _conflicts  = avx2Conflicts;
+    _equal      = avx2Equal;
+    _isZero     = avx2IsZero;
+    _maskedCopy = avx2MaskedCopy;
+    _differingInts = avx2DifferingInts;
+    break;
+#endif
+#if AVX512_KERNELS
+  case AVX512:
+    _writeDiffs = avx512WriteDiffs;
+    _conflicts  = avx512Conflicts;
+    _equal      = avx512Equal;
+    _isZero     = avx512IsZero;
+    _maskedCopy = avx512MaskedCopy;
+    _differingInts = avx512DifferingInts;
+    break;
+#endif
+  default:
+    l = GENERIC;
+    _writeDiffs = genericWriteDiffs;
+    _conflicts  = genericConflicts;
+    _equal      = genericEqual;
+    _isZero     = genericIsZero;
+    _maskedCopy = genericMaskedCopy;
+    _differingInts = genericDifferingInts;
+    break;
+  }
+  _selected = l;
+}
+
+
+xpagekernels::level xpagekernels::selected (void)
+{
+  if (_selected == NUM_LEVELS) {
+    select (best());
+  }
+  return _selected;
+}
+
+
+const char * xpagekernels::name (level l)
+{
+  static const char * names[] = { "generic", "sse2", "avx2", "avx512" };
+  if ((l < GENERIC) || (l >= NUM_LEVELS)) {
+    return "none";
+  }
+  return names[l];
+}
+
+
+void xpagekernels::firstWriteDiffs (const void * local, const void * twin, void * dest)
+{
+  selected();
+  _writeDiffs (local, twin, dest);
+}
+
+bool xpagekernels::firstConflicts (const void * local, const void * twin, const void * committed)
+{
+  selected();
+  return _conflicts (local, twin, committed);
+}
+
+bool xpagekernels::firstEqual (const void * a, const void * b)
+{
+  selected();
+  return _equal (a, b);
+}
+
+bool xpagekernels::firstIsZero (const void * page)
+{
+  selected();
+  return _isZero (page);
+}
+
+void xpagekernels::firstMaskedCopy (const void * src, const void * mask, void * dest)
+{
+  selected();
+  _maskedCopy (src, mask, dest);
+}
+
+unsigned int xpagekernels::firstDifferingInts (const int * a, const int * b)
+{
+  selected();
+  return _differingInts (a, b);
+}
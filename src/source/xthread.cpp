@@ -3,7 +3,8 @@
 
 void * xthread::spawn (xrun * runner,
 		       threadFunction * fn,
-		       void * arg)
+		       void * arg,
+		       int mode)
 {
   // Decide whether we are going to use fork or just directly
   // execute the thread.
@@ -31,14 +32,16 @@ void * xthread::spawn (xrun * runner,
 
   } else {
     
+    // Once we fork, we are no longer alone, so protect memory again.
+    runner->rearm();
     runner->atomicEnd();
 
     // Allocate an object to hold the thread's return value.
-    void * buf = allocateSharedObject (4096);
-    HL::sassert<(4096 > sizeof(ThreadStatus))> checkSize;
+    void * buf = _statusPages.get();
+    HL::sassert<(StatusPagePool::PageSize > sizeof(ThreadStatus))> checkSize;
     ThreadStatus * t = new (buf) ThreadStatus;
 
-    return forkSpawn (runner, fn, t, arg);
+    return forkSpawn (runner, fn, t, arg, mode);
 
   }
 }
@@ -81,10 +84,10 @@ void xthread::sync (xrun * runner,
     
    
   if (didFork) {
-    _tstatHeap.free (t);
+    _statusPages.put (t);
     runner->atomicBegin();
   } else {
-    freeSharedObject (t, 4096);
+    _tstatHeap.free (t);
   }
 }
 
@@ -92,13 +95,21 @@ void xthread::sync (xrun * runner,
 void * xthread::forkSpawn (xrun * runner,
 			   threadFunction * fn,
 			   ThreadStatus * t,
-			   void * arg) 
+			   void * arg,
+			   int mode) 
 {
   t->forked = true;
+  t->ordered = !(mode & UNORDERED);
   
   // Wait on the throttle semaphore.
   //  _throttle.get();
 
+  // The child counts as live from now until it exits.
+  xatomic::increment_and_return (_live);
+  if (!t->ordered) {
+    xatomic::increment_and_return (_unorderedLive);
+  }
+
   // Use fork to create the effect of a thread spawn.
   int child = fork();
   
@@ -108,9 +119,11 @@ void * xthread::forkSpawn (xrun * runner,
     // Store the tid so I can later sync on this thread.
     t->tid = child;
       
-    // My logical predecessor is the child (i.e., I have to wait
-    // for my child to commit before I can).
-    runner->setPred (child);
+    if (t->ordered) {
+      // My logical predecessor is the child (i.e., I have to wait
+      // for my child to commit before I can).
+      runner->setPred (child);
+    }
 
     // Start a new atomic section and return the thread info.
     runner->atomicBegin();
@@ -122,19 +135,32 @@ void * xthread::forkSpawn (xrun * runner,
     // Set "thread_self".
     setId (getpid());
 
+    // Our parent may hand out the pages in its pool again, so we
+    // must not.
+    _statusPages.forget();
+    runner->startThread (mode);
+
     // We're in...
     _nestingLevel++;
 
     // Run the thread...
     run_thread (runner, fn, t, arg);
 
+    // Everything we wrote is committed, so we can no longer get
+    // ahead of anyone.
+    if (!t->ordered) {
+      xatomic::decrement (_unorderedLive);
+    }
+
     // and we're out.
     _nestingLevel--;
 
     // Wait for my logical predecessor, if any.
     runner->waitPred();
     
-    // We're done here.
+    // We're done here. (Stop counting first, so that whoever waits
+    // for us sees that we are gone.)
+    xatomic::decrement (_live);
     setExited();
 
     // Allow another thread to run.
@@ -157,7 +183,7 @@ void xthread::run_thread (xrun * runner,
   // Run the thread inside a transaction.
   runner->atomicBegin();
   void * result = fn (arg);
-  runner->atomicEnd();
+  runner->atomicExit();
     
   // We're done. Write the return value.
   t->retval = result;
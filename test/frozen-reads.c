@@ -0,0 +1,70 @@
+#include <pthread.h>
+#include <stdio.h>
+
+/* Every reader reads a word twice, a while apart, while the writer just
+ahead of it changes that word and commits. With value validation, a
+read page must stay as the reader first saw it (and the commit then
+conflict), so both reads agree; otherwise the new contents would show
+through, and match what committed, and the reader would get away with
+having seen two different values. The writers also store a value that
+is already there, which value validation lets through.
+ */
+
+#define NPAIRS 4
+#define DELAY 20000000L
+
+long a[NPAIRS][512];
+long same[NPAIRS][512];
+long unchanged[512];
+
+long spin (long n)
+{
+  long i, s = 0;
+  for (i = 0; i < n; i++) {
+    s += i % 7;
+  }
+  return s;
+}
+
+void * writer (void * arg)
+{
+  long id = (long) arg;
+  unchanged[0] = 42;
+  a[id][0] = 1 + (spin (DELAY / 10) == 0);
+  return NULL;
+}
+
+void * reader (void * arg)
+{
+  long id = (long) arg;
+  long first = a[id][0] + unchanged[0];
+  long second = (spin (DELAY) == 0) + a[id][0] + unchanged[0];
+  same[id][0] = (first == second) && (second == 43);
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  pthread_t threads[2 * NPAIRS];
+  long i, bad = 0;
+
+  unchanged[0] = 42;
+  for (i = 0; i < NPAIRS; i++) {
+    pthread_create (&threads[2 * i], NULL, writer, (void *) i);
+    pthread_create (&threads[2 * i + 1], NULL, reader, (void *) i);
+  }
+  for (i = 0; i < 2 * NPAIRS; i++) {
+    pthread_join (threads[i], NULL);
+  }
+
+  for (i = 0; i < NPAIRS; i++) {
+    bad += !same[i][0];
+  }
+  if (bad == 0) {
+    printf ("Every reader saw one value!\n");
+    return 0;
+  } else {
+    printf ("%ld readers saw two values.\n", bad);
+    return 1;
+  }
+}
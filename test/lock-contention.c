@@ -0,0 +1,50 @@
+#include <pthread.h>
+#include <stdio.h>
+
+/* Rounds of many short threads that finish at once, so their processes
+all go for the commit lock together (and some of them end up sleeping
+on it). Each one bumps its own counter and a shared total: no increment
+may be lost, and nobody may sleep forever.
+ */
+
+#define NTHREADS 32
+#define NROUNDS 30
+
+long total;
+long mine[NTHREADS][512];
+
+void * increment (void * arg)
+{
+  long id = (long) arg;
+  mine[id][0]++;
+  total++;
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  pthread_t threads[NTHREADS];
+  long i, lost;
+  int round;
+
+  for (round = 0; round < NROUNDS; round++) {
+    for (i = 0; i < NTHREADS; i++) {
+      pthread_create (&threads[i], NULL, increment, (void *) i);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+      pthread_join (threads[i], NULL);
+    }
+  }
+
+  lost = (long) NTHREADS * NROUNDS - total;
+  for (i = 0; i < NTHREADS; i++) {
+    lost += NROUNDS - mine[i][0];
+  }
+  if (lost == 0) {
+    printf ("No increment lost!\n");
+    return 0;
+  } else {
+    printf ("Lost %ld increments.\n", lost);
+    return 1;
+  }
+}
@@ -0,0 +1,52 @@
+#include <pthread.h>
+#include <stdio.h>
+
+/* Every thread increments one counter on each of eight consecutive
+pages, which it commits as one run. A thread that validates while
+another is committing must not see a page's new version before its new
+contents, or it keeps a stale counter and loses an increment. The race
+is narrow, so we run many rounds: every counter must end up at
+NTHREADS * NROUNDS.
+ */
+
+#define NTHREADS 8
+#define NROUNDS 200
+#define NPAGES 8
+#define PAGE_LONGS 512
+
+long counter[NPAGES * PAGE_LONGS];
+
+void * increment (void * arg)
+{
+  int i;
+  for (i = 0; i < NPAGES * PAGE_LONGS; i += PAGE_LONGS) {
+    counter[i] = counter[i] + 1;
+  }
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  pthread_t threads[NTHREADS];
+  int i, round, lost = 0;
+
+  for (round = 0; round < NROUNDS; round++) {
+    for (i = 0; i < NTHREADS; i++) {
+      pthread_create (&threads[i], NULL, increment, NULL);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+      pthread_join (threads[i], NULL);
+    }
+  }
+
+  for (i = 0; i < NPAGES * PAGE_LONGS; i += PAGE_LONGS) {
+    lost += NTHREADS * NROUNDS - counter[i];
+  }
+  if (lost == 0) {
+    printf ("No increment lost!\n");
+    return 0;
+  } else {
+    printf ("Lost %d increments.\n", lost);
+    return 1;
+  }
+}
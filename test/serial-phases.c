@@ -0,0 +1,101 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* The initial thread alternates serial phases -- writing all over the
+heap and printing a line per step, with no other thread alive -- with
+parallel phases that read what it wrote. The serial writes must all be
+visible to the threads spawned afterwards, and every line must be
+printed exactly once (not again by a child that inherited it).
+ */
+
+#define NTHREADS 8
+#define NPHASES 3
+#define NSTEPS 200
+#define N (1024 * 1024)
+
+long * a;
+int seen[NPHASES][NSTEPS];
+
+void * sum (void * arg)
+{
+  long id = (long) arg;
+  long i, s = 0;
+  for (i = id; i < N; i += NTHREADS) {
+    s += a[i];
+  }
+  return (void *) s;
+}
+
+int main (int argc, char * argv[])
+{
+  pthread_t threads[NTHREADS];
+  char output[] = "/tmp/serial-phases.XXXXXX";
+  char line[64];
+  FILE * in;
+  long i, s, expected;
+  int phase, step, fd, bad = 0;
+
+  // Send stdout to a file of our own, to read back at the end.
+  fd = mkstemp (output);
+  if ((fd == -1) || (dup2 (fd, 1) == -1)) {
+    perror (output);
+    return 1;
+  }
+  close (fd);
+  a = (long *) calloc (N, sizeof(long));
+  for (phase = 0; phase < NPHASES; phase++) {
+    for (step = 0; step < NSTEPS; step++) {
+      for (i = step; i < N; i += NSTEPS) {
+	a[i] += 1;
+      }
+      printf ("%d %d\n", phase, step);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+      pthread_create (&threads[i], NULL, sum, (void *) i);
+    }
+    s = 0;
+    for (i = 0; i < NTHREADS; i++) {
+      void * v;
+      pthread_join (threads[i], &v);
+      s += (long) v;
+    }
+    expected = (long) N * (phase + 1);
+    if (s != expected) {
+      fprintf (stderr, "Phase %d: sum = %ld, expected %ld.\n", phase, s, expected);
+      bad++;
+    }
+  }
+  fflush (stdout);
+
+  in = fopen (output, "r");
+  while (in && fgets (line, sizeof(line), in)) {
+    if ((sscanf (line, "%d %d", &phase, &step) != 2)
+	|| (phase < 0) || (phase >= NPHASES) || (step < 0) || (step >= NSTEPS)) {
+      bad++;
+    } else {
+      seen[phase][step]++;
+    }
+  }
+  if (in) {
+    fclose (in);
+  }
+  unlink (output);
+  for (phase = 0; phase < NPHASES; phase++) {
+    for (step = 0; step < NSTEPS; step++) {
+      if (seen[phase][step] != 1) {
+	bad++;
+      }
+    }
+  }
+
+  // (stdout is the file, so report on stderr.)
+  if (bad == 0) {
+    fprintf (stderr, "Every phase correct!\n");
+    return 0;
+  } else {
+    fprintf (stderr, "%d sums or lines wrong.\n", bad);
+    return 1;
+  }
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+
+/* Every thread builds a histogram of its share of a large input,
+reading all of it but writing only its own row (snapshot mode). None of
+the reads should conflict, and every row must come out complete.
+ */
+
+extern void * gracespawn_snapshot (void *(*fn) (void *), void * arg);
+extern void gracesync (void * v, void ** val);
+
+#define NTHREADS 8
+#define N (1024 * 1024)
+#define NBUCKETS 64
+
+long in[N];
+long hist[NTHREADS][NBUCKETS];
+
+void * count (void * arg)
+{
+  long id = (long) arg;
+  long i;
+  for (i = id; i < N; i += NTHREADS) {
+    hist[id][in[i] % NBUCKETS]++;
+  }
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  void * threads[NTHREADS];
+  long i, j, total, bad = 0;
+
+  for (i = 0; i < N; i++) {
+    in[i] = i * 7;
+  }
+  for (i = 0; i < NTHREADS; i++) {
+    threads[i] = gracespawn_snapshot (count, (void *) i);
+  }
+  for (i = 0; i < NTHREADS; i++) {
+    gracesync (threads[i], NULL);
+  }
+
+  for (i = 0; i < NTHREADS; i++) {
+    total = 0;
+    for (j = 0; j < NBUCKETS; j++) {
+      total += hist[i][j];
+    }
+    if (total != N / NTHREADS) {
+      bad++;
+    }
+  }
+  if (bad == 0) {
+    printf ("Every histogram complete!\n");
+    return 0;
+  } else {
+    printf ("%ld histograms incomplete.\n", bad);
+    return 1;
+  }
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+
+/* Every thread increments the same histogram bucket, reading it well
+before writing it back, and checks only its writes for conflicts
+(snapshot mode). Reads do not fault in that mode, so a thread has to
+notice that the bucket changed between its read and its write, or it
+loses its predecessors' increments: the bucket must end up at NTHREADS.
+ */
+
+extern void * gracespawn_snapshot (void *(*fn) (void *), void * arg);
+extern void gracesync (void * v, void ** val);
+
+#define NTHREADS 8
+
+long hist[16];
+
+void delay (long n) {
+  volatile double d = 1.0;
+  long i;
+  for (i = 0; i < n * 300000; i++) {
+    d = d * d + d / d;
+  }
+}
+
+/* Later threads wait longer, so that each writes after its
+predecessor has committed. */
+void * bump (void * arg)
+{
+  long v = hist[3];
+  delay ((long) arg + 1);
+  hist[3] = v + 1;
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  void * threads[NTHREADS];
+  int i;
+
+  for (i = 0; i < NTHREADS; i++) {
+    threads[i] = gracespawn_snapshot (bump, (void *) (long) i);
+  }
+  for (i = 0; i < NTHREADS; i++) {
+    gracesync (threads[i], NULL);
+  }
+
+  if (hist[3] == NTHREADS) {
+    printf ("No increment lost!\n");
+    return 0;
+  } else {
+    printf ("Lost increments: hist[3] = %ld, expected %d.\n", hist[3], NTHREADS);
+    return 1;
+  }
+}
@@ -0,0 +1,69 @@
+#include <pthread.h>
+#include <stdio.h>
+
+/* Spawn and join thousands of short threads, one at a time. Spawning
+must not leak anything that every later fork has to copy, as it once
+leaked each forked thread's status page: after the first few spawns,
+the number of mappings in this process has to stay put.
+ */
+
+#define NSPAWNS 2000
+#define MAX_GROWTH 8
+
+long x[1024];
+
+void * work (void * arg)
+{
+  x[(long) arg % 1024] = (long) arg;
+  return arg;
+}
+
+/* The number of mappings in this process. */
+int count_mappings (void)
+{
+  char line[512];
+  int n = 0;
+  FILE * maps = fopen ("/proc/self/maps", "r");
+  while (maps && fgets (line, sizeof(line), maps)) {
+    n++;
+  }
+  if (maps) {
+    fclose (maps);
+  }
+  return n;
+}
+
+long spawn_some (long first, long count)
+{
+  long i, s = 0;
+  for (i = first; i < first + count; i++) {
+    pthread_t t;
+    void * v;
+    pthread_create (&t, NULL, work, (void *) i);
+    pthread_join (t, &v);
+    s += (long) v;
+  }
+  return s;
+}
+
+int main (int argc, char * argv[])
+{
+  long s;
+  int halfway, end;
+
+  s = spawn_some (0, NSPAWNS / 2);
+  halfway = count_mappings();
+  s += spawn_some (NSPAWNS / 2, NSPAWNS / 2);
+  end = count_mappings();
+
+  if (s != (long) NSPAWNS * (NSPAWNS - 1) / 2) {
+    printf ("Wrong result: %ld.\n", s);
+    return 1;
+  }
+  if (end - halfway > MAX_GROWTH) {
+    printf ("Leaked %d mappings over %d spawns.\n", end - halfway, NSPAWNS / 2);
+    return 1;
+  }
+  printf ("No mappings leaked!\n");
+  return 0;
+}
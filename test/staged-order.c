@@ -0,0 +1,63 @@
+#include <pthread.h>
+#include <stdio.h>
+
+/* The first thread is slow; the rest finish long before it, and so
+stage their write sets. Half of them read what the slow one writes, so
+their staged write sets must be rejected (and the threads re-run); the
+other half can be committed as staged. Either way, the results and the
+log must come out as if the threads had run one after another.
+ */
+
+#define NTHREADS 16
+#define DELAY 100000000L
+
+long x;
+long out[NTHREADS][512];
+long order[NTHREADS];
+long logged;
+
+void * work (void * arg)
+{
+  long id = (long) arg;
+  long i, s = 0;
+  if (id == 0) {
+    for (i = 0; i < DELAY; i++) {
+      s += i % 7;
+    }
+    x = 1 + (s == 0);
+  } else if (id % 2) {
+    out[id][0] = x + id;
+  } else {
+    out[id][0] = 1 + id;
+  }
+  order[logged++] = id;
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  pthread_t threads[NTHREADS];
+  long i, bad = 0;
+
+  for (i = 0; i < NTHREADS; i++) {
+    pthread_create (&threads[i], NULL, work, (void *) i);
+  }
+  for (i = 0; i < NTHREADS; i++) {
+    pthread_join (threads[i], NULL);
+  }
+
+  for (i = 1; i < NTHREADS; i++) {
+    bad += (out[i][0] != 1 + i);
+  }
+  for (i = 0; i < NTHREADS; i++) {
+    bad += (order[i] != i);
+  }
+  bad += (logged != NTHREADS);
+  if (bad == 0) {
+    printf ("Committed in order!\n");
+    return 0;
+  } else {
+    printf ("%ld results out of order.\n", bad);
+    return 1;
+  }
+}
@@ -0,0 +1,82 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Every thread prints a few lines through the same (fully buffered)
+stdout. The printf itself runs between transactions, so whatever stdio
+writes there -- into the buffer, and into the FILE itself -- lands on
+pages the thread already touched, and must be committed along with the
+next transaction. If any of those writes is lost, a line goes missing
+or is printed twice.
+ */
+
+#define NTHREADS 8
+#define NLINES 50
+
+int seen[NTHREADS][NLINES];
+
+void * print_lines (void * arg)
+{
+  long id = (long) arg;
+  int i;
+  for (i = 0; i < NLINES; i++) {
+    printf ("%ld %d\n", id, i);
+  }
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  pthread_t threads[NTHREADS];
+  char output[] = "/tmp/sticky-write.XXXXXX";
+  char line[64];
+  FILE * in;
+  long id;
+  int i, fd, bad = 0;
+
+  // Send stdout to a file of our own, to read back at the end.
+  fd = mkstemp (output);
+  if ((fd == -1) || (dup2 (fd, 1) == -1)) {
+    perror (output);
+    return 1;
+  }
+  close (fd);
+  for (id = 0; id < NTHREADS; id++) {
+    pthread_create (&threads[id], NULL, print_lines, (void *) id);
+  }
+  for (id = 0; id < NTHREADS; id++) {
+    pthread_join (threads[id], NULL);
+  }
+  fflush (stdout);
+
+  in = fopen (output, "r");
+  while (in && fgets (line, sizeof(line), in)) {
+    if ((sscanf (line, "%ld %d", &id, &i) != 2)
+	|| (id < 0) || (id >= NTHREADS) || (i < 0) || (i >= NLINES)) {
+      bad++;
+    } else {
+      seen[id][i]++;
+    }
+  }
+  if (in) {
+    fclose (in);
+  }
+  unlink (output);
+  for (id = 0; id < NTHREADS; id++) {
+    for (i = 0; i < NLINES; i++) {
+      if (seen[id][i] != 1) {
+	bad++;
+      }
+    }
+  }
+
+  // (stdout is the file, so report on stderr.)
+  if (bad == 0) {
+    fprintf (stderr, "Every line printed once!\n");
+    return 0;
+  } else {
+    fprintf (stderr, "%d lines missing, repeated or garbled.\n", bad);
+    return 1;
+  }
+}
@@ -0,0 +1,57 @@
+#include <pthread.h>
+#include <stdio.h>
+
+/* Every thread reads one word of each page it owns, and then writes
+another word of the same page. With a write tracker (uffd or soft-dirty),
+the read makes the page writable, so the write does not fault: it must
+still be found and committed, or the page keeps its old contents.
+ */
+
+#define NTHREADS 8
+#define NPAGES 1024
+
+long a[NTHREADS][NPAGES][512];
+
+void * read_then_write (void * arg)
+{
+  long id = (long) arg;
+  int i;
+  for (i = 0; i < NPAGES; i++) {
+    a[id][i][7] = a[id][i][3] + id;
+  }
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  pthread_t threads[NTHREADS];
+  long id;
+  int i, lost = 0;
+
+  for (id = 0; id < NTHREADS; id++) {
+    for (i = 0; i < NPAGES; i++) {
+      a[id][i][3] = i + 1;
+    }
+  }
+  for (id = 0; id < NTHREADS; id++) {
+    pthread_create (&threads[id], NULL, read_then_write, (void *) id);
+  }
+  for (id = 0; id < NTHREADS; id++) {
+    pthread_join (threads[id], NULL);
+  }
+
+  for (id = 0; id < NTHREADS; id++) {
+    for (i = 0; i < NPAGES; i++) {
+      if (a[id][i][7] != i + 1 + id) {
+	lost++;
+      }
+    }
+  }
+  if (lost == 0) {
+    printf ("No write lost!\n");
+    return 0;
+  } else {
+    printf ("Lost the writes to %d pages.\n", lost);
+    return 1;
+  }
+}
@@ -0,0 +1,68 @@
+#include <pthread.h>
+#include <stdio.h>
+
+/* A fan-out of unordered threads runs next to one long ordered thread,
+which has nobody ahead of it in the commit order (and so could write
+straight to shared memory). The unordered threads must not have to wait
+for it: each one records whether the long thread had finished by the
+time it committed, and none should have.
+ */
+
+extern void * gracespawn_unordered (void *(*fn) (void *), void * arg);
+
+#define NTHREADS 8
+#define NSTEPS 400000000L
+
+long finished;
+long result;
+long saw[NTHREADS][512];
+
+void * quick (void * arg)
+{
+  long id = (long) arg;
+  long i, s = 0;
+  // (Still running when the long thread starts.)
+  for (i = 0; i < NSTEPS / 100; i++) {
+    s += i % 7;
+  }
+  saw[id][0] = finished + (s == 0);
+  return NULL;
+}
+
+void * slow (void * arg)
+{
+  long i, s = 0;
+  for (i = 0; i < NSTEPS; i++) {
+    s += i % 7;
+  }
+  result = s;
+  finished = 1;
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  void * threads[NTHREADS];
+  pthread_t sibling;
+  long i, late = 0;
+
+  for (i = 0; i < NTHREADS; i++) {
+    threads[i] = gracespawn_unordered (quick, (void *) i);
+  }
+  pthread_create (&sibling, NULL, slow, NULL);
+  for (i = 0; i < NTHREADS; i++) {
+    pthread_join ((pthread_t) threads[i], NULL);
+  }
+  pthread_join (sibling, NULL);
+
+  for (i = 0; i < NTHREADS; i++) {
+    late += saw[i][0];
+  }
+  if ((late == 0) && (finished == 1)) {
+    printf ("Unordered threads committed first!\n");
+    return 0;
+  } else {
+    printf ("%ld unordered threads waited for the ordered one.\n", late);
+    return 1;
+  }
+}
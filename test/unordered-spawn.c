@@ -0,0 +1,54 @@
+#include <stdio.h>
+
+/* A fan-out of unordered threads, the first of them slow. Each writes
+its own result, which should commit without waiting for the slow one;
+each also bumps a shared counter, which conflicts, so some of them have
+to re-run in order. Every result and every increment must be there.
+ */
+
+extern void * gracespawn_unordered (void *(*fn) (void *), void * arg);
+extern void gracesync (void * v, void ** val);
+
+#define NTHREADS 16
+#define DELAY 100000000L
+
+long counter;
+long out[NTHREADS][512];
+
+void * work (void * arg)
+{
+  long id = (long) arg;
+  long i, s = 0;
+  long n = (id == 0) ? DELAY : DELAY / 1000;
+  for (i = 0; i < n; i++) {
+    s += i % 7;
+  }
+  out[id][0] = id + 1 + (s == 0);
+  counter++;
+  return NULL;
+}
+
+int main (int argc, char * argv[])
+{
+  void * threads[NTHREADS];
+  long i, bad = 0;
+
+  for (i = 0; i < NTHREADS; i++) {
+    threads[i] = gracespawn_unordered (work, (void *) i);
+  }
+  for (i = 0; i < NTHREADS; i++) {
+    gracesync (threads[i], NULL);
+  }
+
+  for (i = 0; i < NTHREADS; i++) {
+    bad += (out[i][0] != i + 1);
+  }
+  bad += (counter != NTHREADS);
+  if (bad == 0) {
+    printf ("Every unordered thread committed!\n");
+    return 0;
+  } else {
+    printf ("%ld results missing.\n", bad);
+    return 1;
+  }
+}